@@ -1,21 +1,31 @@
+#define _GNU_SOURCE       // memmem, memrchr
 #include <ctype.h>        // isprint
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
-#include <ftw.h>
+#include <limits.h>       // INT_MIN
 #include <locale.h>
 #include <ncurses.h>
+#include <poll.h>
+#include <pthread.h>
 #include <regex.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>    // liczenie '\n' po 16 bajtow
+#endif
 
 #define MAX_PATH 4096
-#define MAX_COMMAND_LENGHT 4096
 #define BUFFER_SIZE 512
 #define MAX_HISTORY_COUNT 10
 #define NOT_ENOUGH_PARAMS "Za malo parametrow"
@@ -25,29 +35,337 @@
 #define PAIR_BLUE 3
 #define PAIR_CYAN 4
 #define PAIR_GREEN 5
+#define DEFAULT_PROMPT "%M[%G%u%N:%Y%w%M]%C%v%B $ %N"
+#define SEGMENT_TEXT 0
+#define SEGMENT_VCS 1
+#define VCS_BRANCH_SIZE 256
+#define VCS_TIMEOUT_MS 30
+#define EDITOR_INITIAL_CAPACITY 256
+#define KEY_WORD_LEFT (KEY_MAX + 1)
+#define KEY_WORD_RIGHT (KEY_MAX + 2)
+#define KEY_PASTE_BEGIN (KEY_MAX + 3)
+#define KEY_PASTE_END (KEY_MAX + 4)
+#define GETDENTS_BUFFER_SIZE (1 << 20)
+#define GLOB_CHAR 0
+#define GLOB_ANY 1
+#define GLOB_SET 2
+#define GLOB_STAR 3
+#define FUZZY_TOP 8
+#define FUZZY_COMMAND 0
+#define FUZZY_FILE 1
+#define FUZZY_HISTORY 2
+#define FUZZY_SCORE_MATCH 16
+#define FUZZY_BONUS_BOUNDARY 8
+#define FUZZY_BONUS_CONSECUTIVE 4
+#define FUZZY_BONUS_FIRST_MULTIPLIER 2
+#define FUZZY_PENALTY_GAP_START 3
+#define FUZZY_PENALTY_GAP 1
+#define FUZZY_NO_MATCH INT_MIN
+#define WALK_BUFFER_SIZE (256 << 10)
+#define WALK_OUTPUT_FLUSH (64 << 10)
+#define WALK_PUSH_BATCH 64
+#define CP_NO_SOURCE 1
+#define CP_OPEN_SOURCE 2
+#define CP_OPEN_DEST 3
+#define CP_READ 4
+#define CP_WRITE 5
+#define CP_LINK 6
+#define GREP_CHUNKS_PER_JOB 8
+#define SPOOL_BUFFER_SIZE (64 << 10)
+#define SPOOL_INDEX_STEP 64
+#define SCROLLBACK_SEARCH_WINDOW (1 << 20)
+#define GREP_MIN_CHUNK (1 << 20)
+#define GREP_MAX_CHUNK (64 << 20)
+#define GREP_STREAM_BUFFER (64 << 10)
 
 int view_rows, view_cols, scrolled_rows = 0;
 WINDOW *w, *p;
+WINDOW *fuzzy_popup = NULL;
 char **history;
 int history_current_index = -1;
 int is_history_full = FALSE;
 
+struct prompt_segment {
+  int type;
+  attr_t attributes;
+  char *text;
+};
+
+struct prompt_cache {
+  int valid;
+  int uses_vcs;
+  char cwd[MAX_PATH];
+  struct prompt_segment *segments;
+  int segments_count;
+};
+
+struct vcs_status {
+  pthread_mutex_t mutex;
+  pthread_cond_t done;
+  int running;
+  char path[MAX_PATH]; // katalog, dla ktorego policzono branch
+  char branch[VCS_BRANCH_SIZE];
+};
+
+struct line_editor {
+  char *buffer;
+  size_t capacity;
+  size_t gap_start; // = pozycja kursora
+  size_t gap_end;
+};
+
+struct word_list {
+  char **words;
+  int count, capacity;
+};
+
+struct linux_dirent64 {
+  ino64_t d_ino;
+  off64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+
+struct dir_listing {
+  char *path;
+  char *names; // nazwy jedna za druga, kazda zakonczona '\0'
+  size_t names_size;
+  size_t *offsets;
+  unsigned char *types;
+  size_t count;
+  struct dir_listing *next;
+};
+
+struct listing_cache {
+  struct dir_listing **buckets;
+  size_t buckets_count, count;
+  char *buffer; // wspolny bufor dla getdents64
+};
+
+struct glob_op {
+  int type;
+  unsigned char character;
+  unsigned char set[32]; // bitmapa znakow dla [...]
+};
+
+struct glob_component {
+  char *text;
+  int has_glob, is_double_star;
+  struct glob_op *ops;
+  int ops_count;
+};
+
+struct glob_pattern {
+  struct glob_component *components;
+  int components_count;
+  int trailing_slash;
+  struct word_list *results;
+  struct listing_cache *listings;
+};
+
+struct fuzzy_pool {
+  char *text; // kandydaci jeden za drugim, kazdy zakonczony '\0'
+  size_t text_size, text_capacity;
+  size_t *offsets;
+  uint32_t *masks; // bit na litere a-z, cyfry, '.', '-', '_', '/', reszte
+  unsigned char *kinds;
+  size_t count, capacity;
+};
+
+struct fuzzy_result {
+  size_t index;
+  int score;
+  size_t length;
+};
+
+struct fuzzy_state {
+  int active;
+  struct fuzzy_pool pool;
+  char *query;
+  struct fuzzy_result results[FUZZY_TOP];
+  int results_count, selected;
+};
+
+struct walker;
+
+struct walk_entry {
+  struct walker *walker;
+  int thread;
+  int dirfd;        // otwarty katalog rodzica (AT_FDCWD dla korzenia)
+  const char *name;
+  const char *path;
+  unsigned char type; // DT_*
+  int has_stat;
+  struct stat st;
+};
+
+// zwraca TRUE, jesli walker ma wejsc do katalogu
+typedef int (*walk_callback)(struct walk_entry *entry);
+
+struct walk_output {
+  char *data;
+  size_t length, capacity;
+};
+
+struct walker {
+  walk_callback callback;
+  void *context;
+  struct word_list queue; // katalogi do przeczytania
+  int threads, waiting, finished;
+  atomic_long errors;
+  struct walk_output *outputs; // osobny bufor wyjscia dla kazdego watku
+  pthread_mutex_t mutex;
+  pthread_cond_t work;
+};
+
+struct walk_thread {
+  struct walker *walker;
+  int index;
+};
+
+struct cp_context {
+  char *source;
+  size_t source_length;
+  char *dest;
+  int override;
+};
+
+struct find_options {
+  struct glob_op *name_ops;
+  int name_ops_count, has_name;
+  char type;
+  int size_sign, has_size;
+  long long size, size_unit;
+  int mtime_sign, has_mtime;
+  long mtime;
+  time_t now;
+};
+
+struct parallel_job {
+  char *argument;
+  pid_t pid;
+  int fd; // stdout i stderr dziecka
+  char *output;
+  size_t length, capacity;
+  int status;
+  int finished, flushed;
+  struct timespec start;
+  double seconds;
+};
+
+struct spool {
+  int fd;
+  size_t size;
+  size_t newlines;
+  int partial_line;      // ostatnia linia bez '\n'
+  size_t *lines;         // lines[k] = offset linii numer k * SPOOL_INDEX_STEP
+  size_t lines_count;
+  size_t lines_capacity;
+  char *map;
+  size_t map_size;
+  char buffer[SPOOL_BUFFER_SIZE];
+  size_t buffered;
+};
+
+struct grep_options {
+  int case_insensitive; // -i
+  int line_numbers;     // -n
+  int files_only;       // -l
+  int quiet;            // -q
+  long max_count;       // -m, -1 => bez limitu
+  int jobs;             // -j
+};
+
+struct matcher {
+  regex_t regex;
+  char *literal;
+  size_t literal_length;
+  int is_literal;
+};
+
+struct grep_match {
+  size_t start, end; // granice linii bez '\n'
+  size_t line;       // numer linii liczony od poczatku chunka
+};
+
+struct grep_chunk {
+  size_t start, end;
+  size_t newlines;
+  struct grep_match *matches;
+  size_t matches_count, matches_capacity;
+  int done;
+};
+
+struct grep_job {
+  const char *data;
+  size_t size;
+  char *pattern;
+  struct grep_options *options;
+  struct grep_chunk *chunks;
+  long chunks_count;
+  atomic_long next_chunk;
+  atomic_long cutoff; // chunki o wiekszym indeksie nie sa juz potrzebne
+  pthread_mutex_t mutex;
+};
+
+struct spool output_spool = {.fd = -1};
+struct prompt_cache prompt;
+struct vcs_status vcs = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER};
+
 void keyLoop();
+void editorInit(struct line_editor *editor);
+size_t editorLength(struct line_editor *editor);
+void editorClear(struct line_editor *editor);
+void editorMoveTo(struct line_editor *editor, size_t position);
+void editorInsert(struct line_editor *editor, const char *text, size_t length);
+void editorSet(struct line_editor *editor, const char *text);
+int editorDeleteBefore(struct line_editor *editor);
+int editorDeleteAfter(struct line_editor *editor);
+void editorMoveLeft(struct line_editor *editor);
+void editorMoveRight(struct line_editor *editor);
+void editorWordLeft(struct line_editor *editor);
+void editorWordRight(struct line_editor *editor);
+char *editorText(struct line_editor *editor);
+void editorRender(struct line_editor *editor, int y, int x, int highlight);
+void fuzzyOpen(struct fuzzy_state *fuzzy, struct line_editor *editor);
+void fuzzyClose(struct fuzzy_state *fuzzy);
+void fuzzyUpdate(struct fuzzy_state *fuzzy, struct line_editor *editor);
+void fuzzyDraw(struct fuzzy_state *fuzzy);
+void fuzzyAccept(struct fuzzy_state *fuzzy, struct line_editor *editor);
 void parseRawCommand(char *raw_command);
 void runCommand(char *command, char **params, int params_count);
+void wordListAdd(struct word_list *list, char *word);
+struct dir_listing *listDirectory(struct listing_cache *cache, char *path);
+int compareStrings(const void *a, const void *b);
+void wordListFree(struct word_list *list);
+void globExpand(char *pattern, char *active, struct word_list *results, struct listing_cache *listings);
+void freeListings(struct listing_cache *cache);
+int isDir(const char *path);
+char *joinPath(char *path, char *name);
 int checkParams(int minimum_params, int maximum_params, int params_count);
-void append(char *str, char character);
+void runParallel(char **params, int params_count);
 int startsWith(char *source, char *prefix);
-void printBackspace();
 int printPrompt();
+void invalidatePrompt();
 void refreshTerminal();
 void scrollDown();
-void clearLineAfter(int y, int x);
 void execute(char **arguments);
 void printHistory();
 void cd(char *path);
-void cp(char *source, char *dest, int recursive, int override, int is_first_call);
-void grep(char *file, char *pattern, int case_insensitive);
+void cp(char *source, char *dest, int recursive, int override);
+void find(char **params, int params_count);
+int globMatch(struct glob_op *ops, int ops_count, const char *name);
+void grep(char *file, char *pattern, struct grep_options *options);
+void spoolBegin();
+void spoolClose();
+void spoolWrite(const char *data, size_t length);
+void spoolEnd();
+void scrollback();
+int matcherCompile(struct matcher *m, char *pattern, int case_insensitive);
+int matcherFindLine(struct matcher *m, const char *data, size_t start, size_t end, size_t *line_start, size_t *line_end);
+void matcherFree(struct matcher *m);
+size_t countNewlines(const char *data, size_t length);
 void help();
 void runExit();
 
@@ -64,6 +382,16 @@ int main() {
 
   keypad(p, TRUE);
   scrollok(p, TRUE);
+
+  // skoki o slowo (ctrl+strzalki, alt+b/f) i znaczniki bracketed paste
+  define_key("\033[1;5D", KEY_WORD_LEFT);
+  define_key("\033[1;5C", KEY_WORD_RIGHT);
+  define_key("\033b", KEY_WORD_LEFT);
+  define_key("\033f", KEY_WORD_RIGHT);
+  define_key("\033[200~", KEY_PASTE_BEGIN);
+  define_key("\033[201~", KEY_PASTE_END);
+  printf("\033[?2004h");
+  fflush(stdout);
   signal(SIGINT, runExit);
 
   history = malloc(MAX_HISTORY_COUNT * sizeof(char *));
@@ -95,7 +423,8 @@ void keyLoop() {
   int x_after_prompt;
   getyx(p, y_after_prompt, x_after_prompt);
 
-  char raw_command[MAX_COMMAND_LENGHT] = {'\0'};
+  struct line_editor raw_command;
+  editorInit(&raw_command);
 
   //-1 => brak
   // 0 do MAX_HISTORY_COUNT - 1 => przegladany element
@@ -104,6 +433,9 @@ void keyLoop() {
   int tab_index = -1;
   char *tab_prefix;
 
+  struct fuzzy_state fuzzy;
+  memset(&fuzzy, 0, sizeof(fuzzy));
+
   MEVENT event;
   mousemask(ALL_MOUSE_EVENTS, NULL);
 
@@ -143,10 +475,31 @@ void keyLoop() {
       history_traveler_index = -1;
     }
 
+    // w trybie fuzzy strzalki, TAB i ESC obsluguja liste podpowiedzi
+    if (fuzzy.active && (charcode == KEY_UP || charcode == KEY_DOWN || charcode == '\t' || charcode == 27 || charcode == 6)) {
+      if (charcode == KEY_UP && fuzzy.selected > 0)
+        fuzzy.selected--;
+      else if (charcode == KEY_DOWN && fuzzy.selected + 1 < fuzzy.results_count)
+        fuzzy.selected++;
+      else if (charcode == '\t') {
+        fuzzyAccept(&fuzzy, &raw_command);
+        editorRender(&raw_command, y_after_prompt, x_after_prompt, FALSE);
+      }
+
+      if (charcode == 27 || charcode == 6) { // ESC, ctrl+f
+        fuzzyClose(&fuzzy);
+      } else {
+        // po wstawieniu lista znika do nastepnej zmiany linii
+        if (charcode == '\t')
+          fuzzy.results_count = 0;
+        fuzzyDraw(&fuzzy);
+      }
+      continue;
+    }
+
     // wcisnieto strzalke i historia nie jest pusta
     if ((charcode == KEY_UP || charcode == KEY_DOWN) && history_current_index != -1) {
-      clearLineAfter(y_after_prompt, x_after_prompt);
-      raw_command[0] = '\0';
+      editorClear(&raw_command);
 
       if (charcode == KEY_UP) {
         history_traveler_index++;
@@ -163,36 +516,90 @@ void keyLoop() {
           history_entry_index = MAX_HISTORY_COUNT + history_entry_index;
         }
 
-        if (has_colors() == FALSE)
-          wprintw(p, history[history_entry_index]);
-        else {
-          wattron(p, COLOR_PAIR(PAIR_CYAN));
-          wprintw(p, history[history_entry_index]);
-          wattroff(p, COLOR_PAIR(PAIR_CYAN));
-        }
-
-        strcpy(raw_command, history[history_entry_index]);
+        editorSet(&raw_command, history[history_entry_index]);
       }
+
+      // wpis z historii wyswietlany na turkusowo dopoki nie zostanie zmieniony
+      editorRender(&raw_command, y_after_prompt, x_after_prompt, history_traveler_index != -1);
     }
 
     switch (charcode) {
     case KEY_BACKSPACE:
     case 127: // backspace
-      if (strlen(raw_command) > 0) {
-        raw_command[strlen(raw_command) - 1] = '\0';
-        printBackspace();
+      if (editorDeleteBefore(&raw_command))
+        editorRender(&raw_command, y_after_prompt, x_after_prompt, FALSE);
+      break;
+
+    case KEY_DC: // delete
+    case 4:      // ctrl+d
+      if (editorDeleteAfter(&raw_command))
+        editorRender(&raw_command, y_after_prompt, x_after_prompt, FALSE);
+      break;
+
+    case KEY_LEFT:
+    case KEY_RIGHT:
+    case KEY_WORD_LEFT:
+    case KEY_WORD_RIGHT:
+    case KEY_HOME:
+    case KEY_END:
+    case 1: // ctrl+a
+    case 5: // ctrl+e
+      if (charcode == KEY_LEFT) editorMoveLeft(&raw_command);
+      else if (charcode == KEY_RIGHT) editorMoveRight(&raw_command);
+      else if (charcode == KEY_WORD_LEFT) editorWordLeft(&raw_command);
+      else if (charcode == KEY_WORD_RIGHT) editorWordRight(&raw_command);
+      else if (charcode == KEY_HOME || charcode == 1) editorMoveTo(&raw_command, 0);
+      else editorMoveTo(&raw_command, editorLength(&raw_command));
+      editorRender(&raw_command, y_after_prompt, x_after_prompt, FALSE);
+      break;
+
+    case 23: { // ctrl+w => usun slowo przed kursorem
+      size_t end = raw_command.gap_start;
+      editorWordLeft(&raw_command);
+      raw_command.gap_end += end - raw_command.gap_start;
+      editorRender(&raw_command, y_after_prompt, x_after_prompt, FALSE);
+      break;
+    }
+
+    case KEY_PASTE_BEGIN: { // bracketed paste => caly blok wstawiany i rysowany raz
+      size_t length = 0, capacity = BUFFER_SIZE;
+      char *pasted = malloc(capacity);
+      while ((charcode = wgetch(p)) != KEY_PASTE_END && charcode != ERR) {
+        if (charcode == '\n' || charcode == '\r' || charcode == '\t')
+          charcode = ' ';
+        if (charcode > 255 || (charcode < 128 && !isprint(charcode)))
+          continue;
+        if (length == capacity)
+          pasted = realloc(pasted, capacity *= 2);
+        pasted[length++] = charcode;
       }
+      editorInsert(&raw_command, pasted, length);
+      editorRender(&raw_command, y_after_prompt, x_after_prompt, FALSE);
+      free(pasted);
+      break;
+    }
+
+    case 6: // ctrl+f => tryb fuzzy
+      fuzzyOpen(&fuzzy, &raw_command);
       break;
 
-    case '\n': // zatwierdzanie komendy
+    case '\n': { // zatwierdzanie komendy
+      if (fuzzy.active)
+        fuzzyClose(&fuzzy);
+      editorMoveTo(&raw_command, editorLength(&raw_command));
+      editorRender(&raw_command, y_after_prompt, x_after_prompt, FALSE);
       waddch(p, '\n');
 
+      char *text = editorText(&raw_command);
+      editorClear(&raw_command);
+
       // usun mozliwe spacje na koncu (trim)
-      for (int i = strlen(raw_command) - 1; raw_command[i] == ' ' && i >= 0; i--)
-        raw_command[i] = '\0';
+      for (int i = strlen(text) - 1; i >= 0 && text[i] == ' '; i--)
+        text[i] = '\0';
 
       // pusta komenda
-      if (strlen(raw_command) == 0) {
+      if (strlen(text) == 0) {
+        free(text);
         if (printPrompt()) return;
         getyx(p, y_after_prompt, x_after_prompt);
         break;
@@ -209,27 +616,27 @@ void keyLoop() {
       if (is_history_full == TRUE) {
         free(history[history_current_index]);
       }
-      history[history_current_index] = malloc(strlen(raw_command) * sizeof(char));
-      strcpy(history[history_current_index], raw_command);
+      history[history_current_index] = strdup(text);
 
       // parsuj
-      parseRawCommand(raw_command);
-
-      // wyczysc bufor
-      raw_command[0] = '\0';
+      parseRawCommand(text);
+      free(text);
 
       if (printPrompt()) return;
       getyx(p, y_after_prompt, x_after_prompt);
       break;
+    }
+
+    case KEY_PPAGE: // przegladanie pelnego wyjscia ostatniej komendy
+      scrollback();
+      break;
 
     case '\t': { // TAB
       DIR *dir;
       struct dirent *entry;
 
-      if (tab_index == -1) {
-        tab_prefix = malloc(strlen(raw_command) * sizeof(char));
-        strcpy(tab_prefix, raw_command);
-      }
+      if (tab_index == -1)
+        tab_prefix = editorText(&raw_command);
 
       tab_index++;
 
@@ -241,9 +648,9 @@ void keyLoop() {
           while ((entry = readdir(dir)) != NULL) {
             if (startsWith(entry->d_name, &tab_prefix[2])) {
               if (i == tab_index) {
-                clearLineAfter(y_after_prompt, x_after_prompt);
-                mvwprintw(p, y_after_prompt, x_after_prompt, "./%s", entry->d_name);
-                strcpy(&raw_command[2], entry->d_name);
+                editorSet(&raw_command, "./");
+                editorInsert(&raw_command, entry->d_name, strlen(entry->d_name));
+                editorRender(&raw_command, y_after_prompt, x_after_prompt, FALSE);
                 break;
               }
               i++;
@@ -254,7 +661,7 @@ void keyLoop() {
         }
       } else {
         char path_env[MAX_PATH] = {'\0'};
-        strcpy(path_env, getenv("PATH"));
+        strncpy(path_env, getenv("PATH") ? getenv("PATH") : "", MAX_PATH - 1);
         if (strlen(path_env) > 0) {
           int searching = TRUE;
           char *buff = strtok(path_env, ":");
@@ -264,9 +671,8 @@ void keyLoop() {
               while ((entry = readdir(dir)) != NULL) {
                 if (startsWith(entry->d_name, tab_prefix)) {
                   if (tab_index == i) {
-                    clearLineAfter(y_after_prompt, x_after_prompt);
-                    mvwprintw(p, y_after_prompt, x_after_prompt, "%s", entry->d_name);
-                    strcpy(raw_command, entry->d_name);
+                    editorSet(&raw_command, entry->d_name);
+                    editorRender(&raw_command, y_after_prompt, x_after_prompt, FALSE);
                     searching = FALSE;
                     break;
                   }
@@ -286,99 +692,921 @@ void keyLoop() {
 
     default:
       if (isprint(charcode)) {
-        waddch(p, charcode);
-        append(raw_command, charcode);
+        char character = charcode;
+        editorInsert(&raw_command, &character, 1);
+        // dopisywanie na koncu linii nie wymaga przerysowania reszty
+        if (raw_command.gap_end == raw_command.capacity)
+          waddch(p, charcode);
+        else
+          editorRender(&raw_command, y_after_prompt, x_after_prompt, FALSE);
       }
       break;
     }
+
+    // kazda zmiana linii przelicza podpowiedzi
+    if (fuzzy.active && charcode != 6 && charcode != KEY_MOUSE)
+      fuzzyUpdate(&fuzzy, &raw_command);
+  }
+}
+
+// EDYTOR LINII
+// bufor z przerwa (gap buffer): przerwa zawsze stoi na pozycji kursora,
+// wiec wstawianie i usuwanie przy kursorze nie przesuwa reszty tekstu
+
+void editorInit(struct line_editor *editor) {
+  editor->capacity = EDITOR_INITIAL_CAPACITY;
+  editor->buffer = malloc(editor->capacity);
+  editor->gap_start = 0;
+  editor->gap_end = editor->capacity;
+}
+
+size_t editorLength(struct line_editor *editor) {
+  return editor->capacity - (editor->gap_end - editor->gap_start);
+}
+
+void editorClear(struct line_editor *editor) {
+  editor->gap_start = 0;
+  editor->gap_end = editor->capacity;
+}
+
+void editorMoveTo(struct line_editor *editor, size_t position) {
+  if (position > editorLength(editor))
+    position = editorLength(editor);
+
+  if (position < editor->gap_start) {
+    size_t count = editor->gap_start - position;
+    memmove(editor->buffer + editor->gap_end - count, editor->buffer + position, count);
+    editor->gap_start -= count;
+    editor->gap_end -= count;
+  } else if (position > editor->gap_start) {
+    size_t count = position - editor->gap_start;
+    memmove(editor->buffer + editor->gap_start, editor->buffer + editor->gap_end, count);
+    editor->gap_start += count;
+    editor->gap_end += count;
+  }
+}
+
+void editorInsert(struct line_editor *editor, const char *text, size_t length) {
+  if (editor->gap_end - editor->gap_start < length) {
+    size_t after = editor->capacity - editor->gap_end;
+    size_t capacity = editor->capacity * 2;
+    while (capacity - editorLength(editor) < length)
+      capacity *= 2;
+
+    editor->buffer = realloc(editor->buffer, capacity);
+    memmove(editor->buffer + capacity - after, editor->buffer + editor->gap_end, after);
+    editor->gap_end = capacity - after;
+    editor->capacity = capacity;
+  }
+
+  memcpy(editor->buffer + editor->gap_start, text, length);
+  editor->gap_start += length;
+}
+
+void editorSet(struct line_editor *editor, const char *text) {
+  editorClear(editor);
+  editorInsert(editor, text, strlen(text));
+}
+
+// bajty kontynuacji UTF-8 (10xxxxxx) nie sa osobnymi znakami
+int isContinuationByte(char character) {
+  return (character & 0xC0) == 0x80;
+}
+
+int editorDeleteBefore(struct line_editor *editor) {
+  if (editor->gap_start == 0)
+    return FALSE;
+  do {
+    editor->gap_start--;
+  } while (editor->gap_start > 0 && isContinuationByte(editor->buffer[editor->gap_start]));
+  return TRUE;
+}
+
+int editorDeleteAfter(struct line_editor *editor) {
+  if (editor->gap_end == editor->capacity)
+    return FALSE;
+  do {
+    editor->gap_end++;
+  } while (editor->gap_end < editor->capacity && isContinuationByte(editor->buffer[editor->gap_end]));
+  return TRUE;
+}
+
+void editorMoveLeft(struct line_editor *editor) {
+  size_t position = editor->gap_start;
+  while (position > 0 && isContinuationByte(editor->buffer[--position]))
+    ;
+  editorMoveTo(editor, position);
+}
+
+void editorMoveRight(struct line_editor *editor) {
+  size_t position = editor->gap_end;
+  if (position == editor->capacity)
+    return;
+  while (++position < editor->capacity && isContinuationByte(editor->buffer[position]))
+    ;
+  editorMoveTo(editor, editor->gap_start + (position - editor->gap_end));
+}
+
+void editorWordLeft(struct line_editor *editor) {
+  size_t position = editor->gap_start;
+  while (position > 0 && editor->buffer[position - 1] == ' ')
+    position--;
+  while (position > 0 && editor->buffer[position - 1] != ' ')
+    position--;
+  editorMoveTo(editor, position);
+}
+
+void editorWordRight(struct line_editor *editor) {
+  size_t position = editor->gap_end;
+  while (position < editor->capacity && editor->buffer[position] == ' ')
+    position++;
+  while (position < editor->capacity && editor->buffer[position] != ' ')
+    position++;
+  editorMoveTo(editor, editor->gap_start + (position - editor->gap_end));
+}
+
+char *editorText(struct line_editor *editor) {
+  size_t after = editor->capacity - editor->gap_end;
+  char *text = malloc(editorLength(editor) + 1);
+  memcpy(text, editor->buffer, editor->gap_start);
+  memcpy(text + editor->gap_start, editor->buffer + editor->gap_end, after);
+  text[editor->gap_start + after] = '\0';
+  return text;
+}
+
+void editorRender(struct line_editor *editor, int y, int x, int highlight) {
+  // cala linia rysowana jednym przebiegiem, kursor wraca na miejsce przerwy
+  wmove(p, y, x);
+  wclrtobot(p);
+
+  if (highlight && has_colors() == TRUE) wattron(p, COLOR_PAIR(PAIR_CYAN));
+  waddnstr(p, editor->buffer, editor->gap_start);
+  int cursor_y, cursor_x;
+  getyx(p, cursor_y, cursor_x);
+  waddnstr(p, editor->buffer + editor->gap_end, editor->capacity - editor->gap_end);
+  if (highlight && has_colors() == TRUE) wattroff(p, COLOR_PAIR(PAIR_CYAN));
+
+  int end_y = getcury(p);
+  wmove(p, cursor_y, cursor_x);
+  if (end_y - view_rows + 1 > scrolled_rows)
+    scrolled_rows = end_y - view_rows + 1;
+}
+
+// FUZZY
+// wszyscy kandydaci leza w jednej tablicy; 32-bitowe maski znakow pozwalaja
+// odrzucic wiekszosc z nich po 4 naraz (SSE2), zanim policzymy wynik
+
+uint32_t fuzzyMask(const char *text, size_t length) {
+  uint32_t mask = 0;
+  for (size_t i = 0; i < length; i++) {
+    unsigned char character = tolower((unsigned char)text[i]);
+    if (character >= 'a' && character <= 'z') mask |= 1u << (character - 'a');
+    else if (character >= '0' && character <= '9') mask |= 1u << 26;
+    else if (character == '.') mask |= 1u << 27;
+    else if (character == '-') mask |= 1u << 28;
+    else if (character == '_') mask |= 1u << 29;
+    else if (character == '/') mask |= 1u << 30;
+    else mask |= 1u << 31;
+  }
+  return mask;
+}
+
+void fuzzyAdd(struct fuzzy_pool *pool, const char *text, int kind) {
+  size_t length = strlen(text);
+  if (pool->count == pool->capacity) {
+    pool->capacity = pool->capacity == 0 ? 1024 : pool->capacity * 2;
+    pool->offsets = realloc(pool->offsets, pool->capacity * sizeof(size_t));
+    pool->masks = realloc(pool->masks, pool->capacity * sizeof(uint32_t));
+    pool->kinds = realloc(pool->kinds, pool->capacity);
+  }
+  if (pool->text_size + length + 1 > pool->text_capacity) {
+    pool->text_capacity = (pool->text_size + length + 1) * 2;
+    pool->text = realloc(pool->text, pool->text_capacity);
+  }
+
+  memcpy(pool->text + pool->text_size, text, length + 1);
+  pool->offsets[pool->count] = pool->text_size;
+  pool->masks[pool->count] = fuzzyMask(text, length);
+  pool->kinds[pool->count] = kind;
+  pool->text_size += length + 1;
+  pool->count++;
+}
+
+void fuzzyBuildPool(struct fuzzy_pool *pool) {
+  // historia od najnowszych
+  for (int i = 0; i <= history_current_index && history_current_index != -1; i++) {
+    int index = history_current_index - i;
+    fuzzyAdd(pool, history[index], FUZZY_HISTORY);
+  }
+  if (is_history_full == TRUE)
+    for (int i = MAX_HISTORY_COUNT - 1; i > history_current_index; i--)
+      fuzzyAdd(pool, history[i], FUZZY_HISTORY);
+
+  struct listing_cache listings;
+  memset(&listings, 0, sizeof(listings));
+  struct dir_listing *listing = listDirectory(&listings, ".");
+  for (size_t k = 0; k < listing->count; k++)
+    fuzzyAdd(pool, listing->names + listing->offsets[k], FUZZY_FILE);
+
+  // komendy z PATH bez powtorzen
+  struct word_list commands = {NULL, 0, 0};
+  char *path_env = strdup(getenv("PATH") ? getenv("PATH") : "");
+  for (char *dir = strtok(path_env, ":"); dir != NULL; dir = strtok(NULL, ":")) {
+    listing = listDirectory(&listings, dir);
+    for (size_t k = 0; k < listing->count; k++)
+      wordListAdd(&commands, listing->names + listing->offsets[k]);
+  }
+  qsort(commands.words, commands.count, sizeof(char *), compareStrings);
+  for (int i = 0; i < commands.count; i++)
+    if (i == 0 || strcmp(commands.words[i], commands.words[i - 1]) != 0)
+      fuzzyAdd(pool, commands.words[i], FUZZY_COMMAND);
+
+  free(commands.words);
+  free(path_env);
+  freeListings(&listings);
+}
+
+void fuzzyFreePool(struct fuzzy_pool *pool) {
+  free(pool->text);
+  free(pool->offsets);
+  free(pool->masks);
+  free(pool->kinds);
+  memset(pool, 0, sizeof(struct fuzzy_pool));
+}
+
+int isWordBoundary(const char *text, size_t i) {
+  return i == 0 || strchr("/-_. ", text[i - 1]) != NULL || (islower((unsigned char)text[i - 1]) && isupper((unsigned char)text[i]));
+}
+
+// wynik w stylu fzf v1: najwczesniejsze dopasowanie podciagu, zawezone od
+// konca do najkrotszego okna; premie za poczatki slow i ciaglosc, kary za przerwy;
+// wynik moze byc ujemny, brak dopasowania to FUZZY_NO_MATCH
+int fuzzyScore(const char *candidate, const char *query, size_t query_length, int *positions) {
+  size_t q = 0, i = 0;
+  for (; candidate[i] != '\0' && q < query_length; i++)
+    if (tolower((unsigned char)candidate[i]) == query[q])
+      q++;
+  if (q < query_length)
+    return FUZZY_NO_MATCH;
+
+  size_t end = i, start = end;
+  while (q > 0)
+    if (tolower((unsigned char)candidate[--start]) == query[q - 1])
+      q--;
+
+  int score = 0, consecutive = 0, in_gap = FALSE;
+  for (i = start; i < end; i++) {
+    if (q < query_length && tolower((unsigned char)candidate[i]) == query[q]) {
+      int bonus = isWordBoundary(candidate, i) ? FUZZY_BONUS_BOUNDARY : 0;
+      if (consecutive > 0 && bonus < FUZZY_BONUS_CONSECUTIVE)
+        bonus = FUZZY_BONUS_CONSECUTIVE;
+      score += FUZZY_SCORE_MATCH + (q == 0 ? bonus * FUZZY_BONUS_FIRST_MULTIPLIER : bonus);
+      if (positions != NULL)
+        positions[q] = i;
+      q++;
+      consecutive++;
+      in_gap = FALSE;
+    } else {
+      score -= in_gap ? FUZZY_PENALTY_GAP : FUZZY_PENALTY_GAP_START;
+      consecutive = 0;
+      in_gap = TRUE;
+    }
+  }
+  return score;
+}
+
+void fuzzyConsider(struct fuzzy_state *fuzzy, size_t index, const char *query, size_t query_length) {
+  const char *candidate = fuzzy->pool.text + fuzzy->pool.offsets[index];
+  int score = fuzzyScore(candidate, query, query_length, NULL);
+  if (score == FUZZY_NO_MATCH)
+    return;
+
+  // top-k trzymane posortowane: wynik malejaco, przy remisie krotszy wyzej
+  size_t length = strlen(candidate);
+  int position = fuzzy->results_count;
+  while (position > 0) {
+    struct fuzzy_result *other = &fuzzy->results[position - 1];
+    if (other->score > score || (other->score == score && other->length <= length))
+      break;
+    position--;
+  }
+  if (position >= FUZZY_TOP)
+    return;
+
+  int last = fuzzy->results_count < FUZZY_TOP ? fuzzy->results_count : FUZZY_TOP - 1;
+  memmove(&fuzzy->results[position + 1], &fuzzy->results[position], (last - position) * sizeof(struct fuzzy_result));
+  fuzzy->results[position].index = index;
+  fuzzy->results[position].score = score;
+  fuzzy->results[position].length = length;
+  if (fuzzy->results_count < FUZZY_TOP)
+    fuzzy->results_count++;
+}
+
+void fuzzySearch(struct fuzzy_state *fuzzy, const char *query) {
+  size_t query_length = strlen(query), i = 0, count = fuzzy->pool.count;
+  char *lower_query = malloc(query_length + 1);
+  for (size_t k = 0; k <= query_length; k++)
+    lower_query[k] = tolower((unsigned char)query[k]);
+
+  uint32_t query_mask = fuzzyMask(query, query_length);
+  uint32_t *masks = fuzzy->pool.masks;
+  fuzzy->results_count = 0;
+  fuzzy->selected = 0;
+  if (query_length == 0) {
+    free(lower_query);
+    return;
+  }
+
+#ifdef __SSE2__
+  const __m128i wanted = _mm_set1_epi32(query_mask);
+  for (; i + 4 <= count; i += 4) {
+    __m128i block = _mm_loadu_si128((const __m128i *)(masks + i));
+    int hits = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(block, wanted), wanted)));
+    while (hits) {
+      fuzzyConsider(fuzzy, i + __builtin_ctz(hits), lower_query, query_length);
+      hits &= hits - 1;
+    }
+  }
+#endif
+
+  for (; i < count; i++)
+    if ((masks[i] & query_mask) == query_mask)
+      fuzzyConsider(fuzzy, i, lower_query, query_length);
+
+  free(lower_query);
+}
+
+// poczatek slowa pod kursorem, czyli zapytania dla komend i plikow
+size_t fuzzyWordStart(struct line_editor *editor) {
+  size_t start = editor->gap_start;
+  while (start > 0 && editor->buffer[start - 1] != ' ')
+    start--;
+  return start;
+}
+
+void fuzzyClosePopup() {
+  if (fuzzy_popup == NULL)
+    return;
+  delwin(fuzzy_popup);
+  fuzzy_popup = NULL;
+  touchwin(p);
+}
+
+void fuzzyDraw(struct fuzzy_state *fuzzy) {
+  fuzzyClosePopup();
+  if (fuzzy->results_count == 0)
+    return;
+
+  static const char *kinds[] = {"cmd ", "plik", "hist"};
+  int rows = fuzzy->results_count, cols = view_cols > 60 ? 60 : view_cols;
+  int cursor_row = getcury(p) - scrolled_rows;
+  int top = cursor_row + 1 + rows <= view_rows ? cursor_row + 1 : cursor_row - rows;
+  if (top < 0)
+    top = 0;
+
+  fuzzy_popup = newwin(rows, cols, top, 0);
+  int query_length = strlen(fuzzy->query);
+  int *positions = malloc((query_length + 1) * sizeof(int));
+  for (int row = 0; row < rows; row++) {
+    struct fuzzy_result *result = &fuzzy->results[row];
+    const char *candidate = fuzzy->pool.text + fuzzy->pool.offsets[result->index];
+    fuzzyScore(candidate, fuzzy->query, query_length, positions);
+
+    attr_t base = row == fuzzy->selected ? A_REVERSE : A_NORMAL;
+    wattrset(fuzzy_popup, base | (has_colors() == TRUE ? COLOR_PAIR(PAIR_CYAN) : A_NORMAL));
+    mvwprintw(fuzzy_popup, row, 0, " %s ", kinds[fuzzy->pool.kinds[result->index]]);
+
+    // dopasowane znaki pogrubione
+    int q = 0;
+    for (int c = 0; candidate[c] != '\0' && getcurx(fuzzy_popup) < cols - 1; c++) {
+      int matched = q < query_length && positions[q] == c;
+      wattrset(fuzzy_popup, base | (matched ? A_BOLD | (has_colors() == TRUE ? COLOR_PAIR(PAIR_YELLOW) : A_NORMAL) : A_NORMAL));
+      waddch(fuzzy_popup, (unsigned char)candidate[c]);
+      if (matched)
+        q++;
+    }
+    wattrset(fuzzy_popup, base);
+    while (getcurx(fuzzy_popup) < cols - 1)
+      waddch(fuzzy_popup, ' ');
+  }
+  free(positions);
+}
+
+void fuzzyUpdate(struct fuzzy_state *fuzzy, struct line_editor *editor) {
+  size_t start = fuzzyWordStart(editor);
+  free(fuzzy->query);
+  fuzzy->query = strndup(editor->buffer + start, editor->gap_start - start);
+  for (char *c = fuzzy->query; *c != '\0'; c++)
+    *c = tolower((unsigned char)*c);
+
+  fuzzySearch(fuzzy, fuzzy->query);
+  fuzzyDraw(fuzzy);
+}
+
+void fuzzyOpen(struct fuzzy_state *fuzzy, struct line_editor *editor) {
+  fuzzyBuildPool(&fuzzy->pool);
+  fuzzy->active = TRUE;
+  fuzzyUpdate(fuzzy, editor);
+}
+
+void fuzzyClose(struct fuzzy_state *fuzzy) {
+  fuzzyClosePopup();
+  fuzzyFreePool(&fuzzy->pool);
+  free(fuzzy->query);
+  fuzzy->query = NULL;
+  fuzzy->active = FALSE;
+  fuzzy->results_count = 0;
+}
+
+void fuzzyAccept(struct fuzzy_state *fuzzy, struct line_editor *editor) {
+  if (fuzzy->results_count == 0)
+    return;
+
+  struct fuzzy_result *result = &fuzzy->results[fuzzy->selected];
+  const char *candidate = fuzzy->pool.text + fuzzy->pool.offsets[result->index];
+
+  // wpis z historii zastepuje cala linie, komenda lub plik tylko slowo pod kursorem
+  if (fuzzy->pool.kinds[result->index] == FUZZY_HISTORY) {
+    editorSet(editor, candidate);
+  } else {
+    editor->gap_start = fuzzyWordStart(editor);
+    editorInsert(editor, candidate, strlen(candidate));
   }
 }
 
 void parseRawCommand(char *raw_command) {
-  int raw_command_lenght = strlen(raw_command);
-  char command[MAX_COMMAND_LENGHT] = {'\0'};
-
-  int i;
-  for (i = 0; raw_command[i] != ' '; i++) {
-    if (raw_command_lenght == i - 1) {
-      // nie ma parametrow
-      char **params = malloc(sizeof(char *));
-      runCommand(command, params, 0);
-      free(params);
+  size_t raw_command_lenght = strlen(raw_command);
+
+  // komenda to wszystko do pierwszej spacji
+  size_t i = strcspn(raw_command, " ");
+  char *command = strndup(raw_command, i);
+
+  struct word_list params = {NULL, 0, 0};
+  struct listing_cache listings;
+  memset(&listings, 0, sizeof(listings));
+
+  if (i < raw_command_lenght) {
+    int escaping_single_quote = 0, escaping_double_quote = 0, has_glob = FALSE;
+
+    // active[k] != 0 => znak *, ? lub [ poza cudzyslowem, czyli do rozwiniecia
+    char *current_param_buffer = malloc(raw_command_lenght + 1);
+    char *active = malloc(raw_command_lenght + 1);
+    size_t length = 0;
+
+    for (size_t j = i + 1; j <= raw_command_lenght; j++) {
+      char charcode = raw_command[j];
+      if (charcode == '\'' && !escaping_double_quote) {
+        escaping_single_quote = 1 - escaping_single_quote;
+        continue;
+      }
+
+      if (charcode == '"' && !escaping_single_quote) {
+        escaping_double_quote = 1 - escaping_double_quote;
+        continue;
+      }
+
+      if (charcode == '\0' || (charcode == ' ' && !escaping_single_quote && !escaping_double_quote)) {
+        current_param_buffer[length] = '\0';
+        if (has_glob)
+          globExpand(current_param_buffer, active, &params, &listings);
+        else
+          wordListAdd(&params, strdup(current_param_buffer));
+        length = 0;
+        has_glob = FALSE;
+        continue;
+      }
+
+      active[length] = !escaping_single_quote && !escaping_double_quote && strchr("*?[", charcode) != NULL;
+      has_glob |= active[length];
+      current_param_buffer[length++] = charcode;
+    }
+
+    free(current_param_buffer);
+    free(active);
+
+    if (escaping_single_quote)
+      wprintw(p, "Brakujacy ' na koncu polecenia\n");
+    else if (escaping_double_quote)
+      wprintw(p, "Brakujacy \" na koncu polecenia\n");
+    if (escaping_single_quote || escaping_double_quote) {
+      wordListFree(&params);
+      freeListings(&listings);
+      free(command);
       return;
-    } else {
-      append(command, raw_command[i]);
     }
   }
 
-  int escaping_single_quote = 0, escaping_double_quote = 0, params_count = 1;
+  freeListings(&listings);
+
+  runCommand(command, params.words, params.count);
+
+  wordListFree(&params);
+  free(command);
+}
 
-  //licz params_count
-  for (int j = i + 1; j < raw_command_lenght; j++) {
-    char charcode = raw_command[j];
-    if (charcode == '\'' && !escaping_double_quote) escaping_single_quote = 1 - escaping_single_quote;
-    else if (charcode == '"' && !escaping_single_quote) escaping_double_quote = 1 - escaping_double_quote;
-    else if (charcode == ' ' && !escaping_single_quote && !escaping_double_quote) params_count++;
+void wordListAdd(struct word_list *list, char *word) {
+  if (list->count == list->capacity) {
+    list->capacity = list->capacity == 0 ? 8 : list->capacity * 2;
+    list->words = realloc(list->words, list->capacity * sizeof(char *));
   }
+  list->words[list->count++] = word;
+}
 
-  escaping_single_quote = 0;
-  escaping_double_quote = 0;
+void wordListFree(struct word_list *list) {
+  for (int j = 0; j < list->count; j++)
+    free(list->words[j]);
+  free(list->words);
+}
 
-  char **params = malloc(params_count * sizeof(char *));
-  int current_param = 0;
-  char current_param_buffer[MAX_COMMAND_LENGHT] = {'\0'};
+// GLOB
+// listingi katalogow sa wspoldzielone przez wszystkie wzorce z jednej linii,
+// trzymane w tablicy haszujacej po sciezce (** odwiedza tysiace katalogow)
 
-  for (int j = i + 1; j < raw_command_lenght; j++) {
-    char charcode = raw_command[j];
-    if (charcode == '\'' && !escaping_double_quote) {
-      escaping_single_quote = 1 - escaping_single_quote;
-      continue;
+size_t hashPath(const char *path) {
+  size_t hash = 14695981039346656037UL; // FNV-1a
+  for (; *path != '\0'; path++)
+    hash = (hash ^ (unsigned char)*path) * 1099511628211UL;
+  return hash;
+}
+
+void growListingCache(struct listing_cache *cache) {
+  size_t buckets_count = cache->buckets_count == 0 ? 64 : cache->buckets_count * 2;
+  struct dir_listing **buckets = calloc(buckets_count, sizeof(struct dir_listing *));
+  for (size_t i = 0; i < cache->buckets_count; i++) {
+    struct dir_listing *listing = cache->buckets[i];
+    while (listing != NULL) {
+      struct dir_listing *next = listing->next;
+      size_t bucket = hashPath(listing->path) & (buckets_count - 1);
+      listing->next = buckets[bucket];
+      buckets[bucket] = listing;
+      listing = next;
+    }
+  }
+  free(cache->buckets);
+  cache->buckets = buckets;
+  cache->buckets_count = buckets_count;
+}
+
+struct dir_listing *listDirectory(struct listing_cache *cache, char *path) {
+  if (cache->buckets_count > 0) {
+    size_t bucket = hashPath(path) & (cache->buckets_count - 1);
+    for (struct dir_listing *listing = cache->buckets[bucket]; listing != NULL; listing = listing->next)
+      if (strcmp(listing->path, path) == 0)
+        return listing;
+  }
+
+  if (cache->count >= cache->buckets_count)
+    growListingCache(cache);
+
+  struct dir_listing *listing = calloc(1, sizeof(struct dir_listing));
+  size_t bucket = hashPath(path) & (cache->buckets_count - 1);
+  listing->path = strdup(path);
+  listing->next = cache->buckets[bucket];
+  cache->buckets[bucket] = listing;
+  cache->count++;
+
+  int fd = open(path, O_RDONLY | O_DIRECTORY);
+  if (fd == -1)
+    return listing;
+
+  // getdents64 oddaje od razu setki wpisow, bez narzutu readdir() na kazdy z nich
+  if (cache->buffer == NULL)
+    cache->buffer = malloc(GETDENTS_BUFFER_SIZE);
+  char *buffer = cache->buffer;
+  size_t names_capacity = 0, entries_capacity = 0;
+  long num;
+  while ((num = syscall(SYS_getdents64, fd, buffer, GETDENTS_BUFFER_SIZE)) > 0) {
+    for (long offset = 0; offset < num;) {
+      struct linux_dirent64 *entry = (struct linux_dirent64 *)(buffer + offset);
+      offset += entry->d_reclen;
+
+      if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+        continue;
+
+      // pierwsza partia getdents jest zawsze wieksza niz same nazwy z niej
+      size_t name_length = strlen(entry->d_name) + 1;
+      if (listing->names_size + name_length > names_capacity) {
+        names_capacity = names_capacity == 0 ? (size_t)num : names_capacity * 2;
+        listing->names = realloc(listing->names, names_capacity);
+      }
+      if (listing->count == entries_capacity) {
+        entries_capacity = entries_capacity == 0 ? 16 : entries_capacity * 2;
+        listing->offsets = realloc(listing->offsets, entries_capacity * sizeof(size_t));
+        listing->types = realloc(listing->types, entries_capacity);
+      }
+      if (listing->names == NULL || listing->offsets == NULL || listing->types == NULL) {
+        listing->count = 0;
+        break;
+      }
+
+      memcpy(listing->names + listing->names_size, entry->d_name, name_length);
+      listing->offsets[listing->count] = listing->names_size;
+      listing->types[listing->count] = entry->d_type;
+      listing->names_size += name_length;
+      listing->count++;
     }
+  }
 
-    if (charcode == '"' && !escaping_single_quote) {
-      escaping_double_quote = 1 - escaping_double_quote;
-      continue;
+  close(fd);
+  return listing;
+}
+
+void freeListings(struct listing_cache *cache) {
+  for (size_t i = 0; i < cache->buckets_count; i++) {
+    struct dir_listing *listing = cache->buckets[i];
+    while (listing != NULL) {
+      struct dir_listing *next = listing->next;
+      free(listing->path);
+      free(listing->names);
+      free(listing->offsets);
+      free(listing->types);
+      free(listing);
+      listing = next;
     }
+  }
+  free(cache->buckets);
+  free(cache->buffer);
+  memset(cache, 0, sizeof(struct listing_cache));
+}
 
-    if (charcode == ' ' && !escaping_single_quote && !escaping_double_quote) {
-      params[current_param] = malloc(strlen(current_param_buffer) * sizeof(char));
-      strcpy(params[current_param], current_param_buffer);
-      current_param++;
-      current_param_buffer[0] = '\0';
-      continue;
+// kompiluje jeden skladnik sciezki (bez '/') do tablicy operacji
+struct glob_op *globCompile(char *pattern, char *active, size_t length, int *ops_count) {
+  struct glob_op *ops = calloc(length + 1, sizeof(struct glob_op));
+  int count = 0;
+
+  for (size_t k = 0; k < length; k++) {
+    unsigned char charcode = pattern[k];
+    struct glob_op *op = &ops[count];
+
+    if (active[k] && charcode == '*') {
+      if (count > 0 && ops[count - 1].type == GLOB_STAR)
+        continue;
+      op->type = GLOB_STAR;
+    } else if (active[k] && charcode == '?') {
+      op->type = GLOB_ANY;
+    } else if (active[k] && charcode == '[' && memchr(pattern + k + 2, ']', length > k + 2 ? length - k - 2 : 0) != NULL) {
+      size_t c = k + 1;
+      int negate = pattern[c] == '!' || pattern[c] == '^';
+      if (negate) c++;
+
+      // pierwszy ']' po '[' lub '[!' nalezy do zbioru
+      int first = TRUE;
+      while (c < length && (first || pattern[c] != ']')) {
+        unsigned char from = pattern[c], to = from;
+        if (c + 2 < length && pattern[c + 1] == '-' && pattern[c + 2] != ']') {
+          to = pattern[c + 2];
+          c += 2;
+        }
+        for (int value = from; value <= to; value++)
+          op->set[value / 8] |= 1 << (value % 8);
+        c++;
+        first = FALSE;
+      }
+
+      if (c >= length) {
+        // brak zamykajacego ']' => zwykly znak
+        memset(op->set, 0, sizeof(op->set));
+        op->type = GLOB_CHAR;
+        op->character = charcode;
+      } else {
+        if (negate)
+          for (int b = 0; b < 32; b++)
+            op->set[b] = ~op->set[b];
+        op->type = GLOB_SET;
+        k = c;
+      }
+    } else {
+      op->type = GLOB_CHAR;
+      op->character = charcode;
+    }
+    count++;
+  }
+
+  *ops_count = count;
+  return ops;
+}
+
+int globOpMatches(struct glob_op *op, unsigned char charcode) {
+  switch (op->type) {
+  case GLOB_CHAR:
+    return op->character == charcode;
+  case GLOB_ANY:
+    return TRUE;
+  case GLOB_SET:
+    return (op->set[charcode / 8] >> (charcode % 8)) & 1;
+  }
+  return FALSE;
+}
+
+int globMatch(struct glob_op *ops, int ops_count, const char *name) {
+  // dopasowanie z nawrotem tylko do ostatniej '*', liniowe dla typowych wzorcow
+  int op = 0, star_op = -1;
+  const char *s = name, *star_s = NULL;
+  while (*s != '\0') {
+    if (op < ops_count && ops[op].type == GLOB_STAR) {
+      star_op = op++;
+      star_s = s;
+    } else if (op < ops_count && globOpMatches(&ops[op], *s)) {
+      op++;
+      s++;
+    } else if (star_op != -1) {
+      op = star_op + 1;
+      s = ++star_s;
+    } else {
+      return FALSE;
     }
+  }
+
+  while (op < ops_count && ops[op].type == GLOB_STAR)
+    op++;
+  return op == ops_count;
+}
+
+char *joinPath(char *path, char *name) {
+  size_t path_length = strlen(path);
+  char *joined = malloc(path_length + strlen(name) + 2);
+  if (path_length == 0)
+    strcpy(joined, name);
+  else if (path[path_length - 1] == '/')
+    sprintf(joined, "%s%s", path, name);
+  else
+    sprintf(joined, "%s/%s", path, name);
+  return joined;
+}
+
+int isListingDir(struct dir_listing *listing, size_t index, char *fullpath) {
+  if (listing->types[index] == DT_DIR)
+    return TRUE;
+  if (listing->types[index] == DT_LNK || listing->types[index] == DT_UNKNOWN)
+    return isDir(fullpath);
+  return FALSE;
+}
+
+// do rekurencji ** : dowiazania symboliczne nigdy nie sa katalogami, takze gdy
+// system plikow nie wypelnia d_type (lstat zamiast stat), wiec petle sa niemozliwe
+int isListingRealDir(struct dir_listing *listing, size_t index, char *fullpath) {
+  if (listing->types[index] == DT_DIR)
+    return TRUE;
+  struct stat st;
+  if (listing->types[index] == DT_UNKNOWN && lstat(fullpath, &st) == 0)
+    return S_ISDIR(st.st_mode);
+  return FALSE;
+}
+
+void globExpandFrom(struct glob_pattern *glob, char *path, int index, int after_glob) {
+  if (index == glob->components_count) {
+    if (glob->trailing_slash)
+      wordListAdd(glob->results, joinPath(path, ""));
+    else
+      wordListAdd(glob->results, strdup(path));
+    return;
+  }
+
+  struct glob_component *component = &glob->components[index];
+  char *listing_path = strlen(path) == 0 ? "." : path;
 
-    append(current_param_buffer, charcode);
+  if (!component->has_glob) {
+    char *next = joinPath(path, component->text);
+    struct stat st;
+    if (!after_glob || lstat(next, &st) == 0)
+      globExpandFrom(glob, next, index + 1, after_glob);
+    free(next);
+    return;
   }
 
-  if(escaping_single_quote) {
-    wprintw(p, "Brakujacy ' na koncu polecenia\n");
+  struct dir_listing *listing = listDirectory(glob->listings, listing_path);
+
+  if (component->is_double_star && index == glob->components_count - 1) {
+    // ** na koncu => wszystkie wpisy rekurencyjnie (z '/' na koncu tylko katalogi)
+    for (size_t k = 0; k < listing->count; k++) {
+      char *name = listing->names + listing->offsets[k];
+      if (name[0] == '.')
+        continue;
+      char *next = joinPath(path, name);
+      int descend = isListingRealDir(listing, k, next);
+      if (glob->trailing_slash && descend)
+        wordListAdd(glob->results, joinPath(next, ""));
+      else if (!glob->trailing_slash)
+        wordListAdd(glob->results, strdup(next));
+      if (descend)
+        globExpandFrom(glob, next, index, TRUE);
+      free(next);
+    }
     return;
-  } else if(escaping_double_quote) {
-    wprintw(p, "Brakujacy \" na koncu polecenia\n");
+  }
+
+  if (component->is_double_star) {
+    // ** => zero lub wiecej katalogow, bez wchodzenia w dowiazania symboliczne
+    globExpandFrom(glob, path, index + 1, TRUE);
+    for (size_t k = 0; k < listing->count; k++) {
+      char *name = listing->names + listing->offsets[k];
+      if (name[0] == '.' || listing->types[k] == DT_LNK)
+        continue;
+      char *next = joinPath(path, name);
+      if (isListingRealDir(listing, k, next))
+        globExpandFrom(glob, next, index, TRUE);
+      free(next);
+    }
     return;
   }
 
-  params[current_param] = malloc(strlen(current_param_buffer) * sizeof(char));
-  strcpy(params[current_param], current_param_buffer);
+  for (size_t k = 0; k < listing->count; k++) {
+    char *name = listing->names + listing->offsets[k];
+
+    // pliki ukryte tylko gdy wzorzec jawnie zaczyna sie od '.'
+    if (name[0] == '.' && (component->ops[0].type != GLOB_CHAR || component->ops[0].character != '.'))
+      continue;
+    if (!globMatch(component->ops, component->ops_count, name))
+      continue;
+
+    char *next = joinPath(path, name);
+    if (index == glob->components_count - 1 && !glob->trailing_slash)
+      wordListAdd(glob->results, next);
+    else {
+      if (isListingDir(listing, k, next))
+        globExpandFrom(glob, next, index + 1, TRUE);
+      free(next);
+    }
+  }
+}
+
+int compareStrings(const void *a, const void *b) {
+  return strcmp(*(char **)a, *(char **)b);
+}
+
+void globExpand(char *pattern, char *active, struct word_list *results, struct listing_cache *listings) {
+  struct glob_pattern glob;
+  size_t length = strlen(pattern);
+  glob.results = results;
+  glob.listings = listings;
+  glob.trailing_slash = length > 1 && pattern[length - 1] == '/';
+  glob.components = calloc(length + 1, sizeof(struct glob_component));
+  glob.components_count = 0;
+
+  size_t start = pattern[0] == '/' ? 1 : 0;
+  while (start < length) {
+    size_t end = start;
+    while (end < length && pattern[end] != '/')
+      end++;
+
+    if (end > start) {
+      struct glob_component *component = &glob.components[glob.components_count++];
+      component->text = strndup(pattern + start, end - start);
+      component->has_glob = memchr(active + start, 1, end - start) != NULL;
+      component->is_double_star = end - start == 2 && active[start] && active[start + 1] &&
+                                  pattern[start] == '*' && pattern[start + 1] == '*';
+      if (component->has_glob)
+        component->ops = globCompile(pattern + start, active + start, end - start, &component->ops_count);
+    }
+    start = end + 1;
+  }
+
+  int first_result = results->count;
+  globExpandFrom(&glob, pattern[0] == '/' ? "/" : "", 0, FALSE);
 
-  runCommand(command, params, params_count);
+  if (results->count == first_result)
+    wordListAdd(results, strdup(pattern)); // brak dopasowan => wzorzec przechodzi dalej bez zmian
+  else
+    qsort(results->words + first_result, results->count - first_result, sizeof(char *), compareStrings);
 
-  for (int j = 0; j < params_count; j++)
-    free(params[j]);
-  free(params);
+  for (int k = 0; k < glob.components_count; k++) {
+    free(glob.components[k].text);
+    free(glob.components[k].ops);
+  }
+  free(glob.components);
 }
 
 void runCommand(char *command, char **params, int params_count) {
   if (strcmp("", command) == 0)
     return;
 
+  // spool trzyma wyjscie tylko ostatniej komendy: komendy, ktore go nie
+  // zapisuja (echo, history, cp bez -R...) zostawiaja go pustym
+  if (strcmp("scrollback", command) != 0)
+    spoolClose();
+
   if (strcmp("cd", command) == 0) {
     if (checkParams(1, 1, params_count))
       cd(params[0]);
     return;
   }
 
+  if (strcmp("export", command) == 0) {
+    if (checkParams(1, -1, params_count)) {
+      for (int i = 0; i < params_count; i++) {
+        char *value = strchr(params[i], '=');
+        if (value == NULL) {
+          wprintw(p, "Oczekiwano NAZWA=wartosc: %s\n", params[i]);
+          continue;
+        }
+        *value = '\0';
+        setenv(params[i], value + 1, 1);
+      }
+      invalidatePrompt();
+    }
+    return;
+  }
+
   if (strcmp("help", command) == 0) {
     help();
     return;
@@ -398,6 +1626,18 @@ void runCommand(char *command, char **params, int params_count) {
     return;
   }
 
+  if (strcmp("parallel", command) == 0) {
+    if (checkParams(3, -1, params_count))
+      runParallel(params, params_count);
+    return;
+  }
+
+  if (strcmp("scrollback", command) == 0) {
+    if (checkParams(0, 0, params_count))
+      scrollback();
+    return;
+  }
+
   if (strcmp("history", command) == 0) {
     if (checkParams(0, 0, params_count))
       printHistory();
@@ -416,33 +1656,59 @@ void runCommand(char *command, char **params, int params_count) {
   if (strcmp("cp", command) == 0) {
     if(params_count == 4) {
       if ((strcmp(params[0], "-R") == 0 && strcmp(params[1], "-O") == 0) || (strcmp(params[1], "-R") == 0 && strcmp(params[0], "-O") == 0))
-        cp(params[2], params[3], 1, 1, 1); // -R -O
+        cp(params[2], params[3], 1, 1); // -R -O
       else
         checkParams(2, 2, params_count);
     } else if(params_count == 3) {
       if (strcmp(params[0], "-R") == 0)
-        cp(params[1], params[2], 1, 0, 1); // -R
+        cp(params[1], params[2], 1, 0); // -R
       else if (strcmp(params[0], "-O") == 0)
-        cp(params[1], params[2], 0, 1, 1); // -O
+        cp(params[1], params[2], 0, 1); // -O
       else
         checkParams(2, 2, params_count);
     } else if(params_count == 2) {
-      cp(params[0], params[1], 0, 0, 1);
+      cp(params[0], params[1], 0, 0);
     } else {
       checkParams(2, 2, params_count);
     }
     return;
   }
 
+  if (strcmp("find", command) == 0) {
+    find(params, params_count);
+    return;
+  }
+
   if (strcmp("grep", command) == 0) {
-    if(params_count == 3){
-      if(strcmp(params[0], "-i") == 0)
-        grep(params[2], params[1], 1);
-      else
-        checkParams(2, 2, params_count);
-    } else if(checkParams(2, 2, params_count)) {
-      grep(params[1], params[0], 0);
+    struct grep_options options = {0, 0, 0, 0, -1, 1};
+    int i = 0;
+    for (; i < params_count && params[i][0] == '-' && params[i][1] != '\0'; i++) {
+      // flagi mozna laczyc (-in), -m i -j koncza grupe swoja wartoscia
+      for (char *flag = &params[i][1]; *flag != '\0'; flag++) {
+        if (*flag == 'i') options.case_insensitive = 1;
+        else if (*flag == 'n') options.line_numbers = 1;
+        else if (*flag == 'l') options.files_only = 1;
+        else if (*flag == 'q') options.quiet = 1;
+        else if (*flag == 'm' || *flag == 'j') {
+          // wartosc moze byc doklejona (-j4) albo w osobnym parametrze (-j 4)
+          char name = *flag;
+          char *value = flag[1] != '\0' ? &flag[1] : (i + 1 < params_count ? params[++i] : NULL);
+          if (value == NULL || atol(value) < (name == 'm' ? 0 : 1)) {
+            wprintw(p, "Niepoprawna wartosc opcji -%c\n", name);
+            return;
+          }
+          if (name == 'm') options.max_count = atol(value);
+          else options.jobs = atoi(value);
+          break;
+        } else {
+          wprintw(p, "Nieznana opcja %s\n", params[i]);
+          return;
+        }
+      }
     }
+
+    if (checkParams(2, 2, params_count - i))
+      grep(params[i + 1], params[i], &options);
     return;
   }
 
@@ -464,22 +1730,298 @@ void runCommand(char *command, char **params, int params_count) {
     close(fd);
     close(trash);
   } else {
-    char buffer[BUFFER_SIZE] = {'\0'};
+    char buffer[BUFFER_SIZE];
     int fd = open(".fifo", O_RDONLY);
     int num;
+    spoolBegin();
     while ((num = read(fd, &buffer, BUFFER_SIZE)) > 0) {
-      buffer[num] = '\0';
-      wprintw(p, "%s", buffer);
+      if (output_spool.fd == -1)
+        waddnstr(p, buffer, num); // brak pliku tymczasowego => wypisz wprost
+      else
+        spoolWrite(buffer, num);
     }
     close(fd);
     unlink(".fifo");
+    spoolEnd();
   }
 
   free(arguments);
 }
 
-int checkParams(int minimum_params, int maximum_params, int params_count) {
-  if (params_count < minimum_params) {
+// PARALLEL
+// N dzieci naraz, wyjscie kazdego zbierane do osobnego bufora i wypisywane w calosci
+
+double elapsedSeconds(struct timespec *start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+char *replacePlaceholder(char *word, char *argument) {
+  size_t count = 0;
+  for (char *c = strstr(word, "{}"); c != NULL; c = strstr(c + 2, "{}"))
+    count++;
+
+  char *result = malloc(strlen(word) + count * strlen(argument) + 1), *out = result;
+  for (char *c = word; *c != '\0';) {
+    if (c[0] == '{' && c[1] == '}') {
+      out = stpcpy(out, argument);
+      c += 2;
+    } else {
+      *out++ = *c++;
+    }
+  }
+  *out = '\0';
+  return result;
+}
+
+void startParallelJob(struct parallel_job *job, char **command, int command_count, int has_placeholder) {
+  int pipe_fds[2];
+  clock_gettime(CLOCK_MONOTONIC, &job->start);
+  if (pipe(pipe_fds) == -1) {
+    job->finished = TRUE;
+    job->status = -1;
+    return;
+  }
+
+  job->pid = fork();
+  if (job->pid == 0) {
+    char **arguments = malloc((command_count + 2) * sizeof(char *));
+    int i = 0;
+    for (; i < command_count; i++)
+      arguments[i] = has_placeholder ? replacePlaceholder(command[i], job->argument) : command[i];
+    if (!has_placeholder)
+      arguments[i++] = job->argument;
+    arguments[i] = NULL;
+
+    int trash = open("/dev/null", O_RDONLY);
+    dup2(trash, 0);
+    dup2(pipe_fds[1], 1);
+    dup2(pipe_fds[1], 2);
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+    execute(arguments);
+  }
+
+  close(pipe_fds[1]);
+  job->fd = pipe_fds[0];
+  if (job->pid == -1) {
+    close(job->fd);
+    job->finished = TRUE;
+    job->status = -1;
+  }
+}
+
+void readParallelJob(struct parallel_job *job) {
+  if (job->length + BUFFER_SIZE > job->capacity) {
+    job->capacity = job->capacity == 0 ? 4 * BUFFER_SIZE : job->capacity * 2;
+    job->output = realloc(job->output, job->capacity);
+  }
+
+  ssize_t num = read(job->fd, job->output + job->length, job->capacity - job->length);
+  if (num > 0) {
+    job->length += num;
+    return;
+  }
+  if (num == -1 && errno == EINTR)
+    return;
+
+  // EOF => dziecko zamknelo wyjscie, zbieramy kod wyjscia
+  close(job->fd);
+  int status;
+  waitpid(job->pid, &status, 0);
+  job->status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+  job->seconds = elapsedSeconds(&job->start);
+  job->finished = TRUE;
+}
+
+void flushParallelJob(struct parallel_job *job) {
+  spoolWrite(job->output, job->length);
+  if (job->length > 0 && job->output[job->length - 1] != '\n')
+    spoolWrite("\n", 1);
+  free(job->output);
+  job->output = NULL;
+  job->flushed = TRUE;
+}
+
+// poll() zawiodl na dobre: zabijamy i zbieramy dzieci, ktore jeszcze dzialaja,
+// zeby nie zostaly zombie ani otwarte deskryptory
+void stopParallelJobs(struct parallel_job *all, int count) {
+  for (int i = 0; i < count; i++) {
+    if (all[i].finished)
+      continue;
+
+    kill(all[i].pid, SIGKILL);
+    close(all[i].fd);
+    int status;
+    waitpid(all[i].pid, &status, 0);
+    all[i].status = 128 + SIGKILL;
+    all[i].seconds = elapsedSeconds(&all[i].start);
+    all[i].finished = TRUE;
+  }
+}
+
+void parallel(char **command, int command_count, char **arguments, int arguments_count, int jobs, int keep_order) {
+  struct parallel_job *all = calloc(arguments_count, sizeof(struct parallel_job));
+  struct pollfd *fds = malloc(jobs * sizeof(struct pollfd));
+  int *fd_jobs = malloc(jobs * sizeof(int));
+
+  int has_placeholder = FALSE;
+  for (int i = 0; i < command_count; i++)
+    if (strstr(command[i], "{}") != NULL)
+      has_placeholder = TRUE;
+
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  spoolBegin();
+
+  int next = 0, running = 0, completed = 0, next_to_flush = 0;
+  while (completed < arguments_count) {
+    while (running < jobs && next < arguments_count) {
+      all[next].argument = arguments[next];
+      startParallelJob(&all[next], command, command_count, has_placeholder);
+      if (all[next].finished)
+        completed++;
+      else
+        running++;
+      next++;
+    }
+
+    int fds_count = 0;
+    for (int i = next_to_flush; i < next && fds_count < running; i++) {
+      if (!all[i].finished) {
+        fds[fds_count].fd = all[i].fd;
+        fds[fds_count].events = POLLIN;
+        fds[fds_count].revents = 0;
+        fd_jobs[fds_count++] = i;
+      }
+    }
+
+    if (fds_count > 0 && poll(fds, fds_count, -1) == -1) {
+      // EINTR (np. SIGWINCH przy zmianie rozmiaru okna) => revents sa niewazne
+      if (errno == EINTR)
+        continue;
+
+      wprintw(p, "parallel: blad poll(), przerwano pozostale zadania\n");
+      stopParallelJobs(all, next);
+      for (int i = next_to_flush; i < next; i++)
+        if (!all[i].flushed)
+          flushParallelJob(&all[i]);
+      for (; next < arguments_count; next++) {
+        all[next].argument = arguments[next];
+        all[next].status = -1; // nieuruchomione
+      }
+      break;
+    }
+
+    for (int i = 0; i < fds_count; i++) {
+      if (fds[i].revents == 0)
+        continue;
+
+      struct parallel_job *job = &all[fd_jobs[i]];
+      readParallelJob(job);
+      if (job->finished) {
+        running--;
+        completed++;
+        if (!keep_order)
+          flushParallelJob(job);
+      }
+    }
+
+    // -k: wypisujemy tylko ciagly prefiks zakonczonych zadan
+    while (next_to_flush < next && all[next_to_flush].finished) {
+      if (!all[next_to_flush].flushed)
+        flushParallelJob(&all[next_to_flush]);
+      next_to_flush++;
+    }
+  }
+
+  spoolEnd();
+
+  int failed = 0;
+  double total = 0;
+  for (int i = 0; i < arguments_count; i++) {
+    total += all[i].seconds;
+    if (all[i].status != 0)
+      failed++;
+  }
+
+  if (has_colors() == TRUE) wattron(p, COLOR_PAIR(failed > 0 ? PAIR_MAGENTA : PAIR_GREEN));
+  wprintw(p, "parallel: %d zadan, %d bledow, czas %.2f s (suma czasow zadan %.2f s)\n",
+          arguments_count, failed, elapsedSeconds(&start), total);
+  for (int i = 0; i < arguments_count; i++)
+    if (all[i].status != 0)
+      wprintw(p, "  [kod %d] %s\n", all[i].status, all[i].argument);
+  if (has_colors() == TRUE) wattroff(p, COLOR_PAIR(failed > 0 ? PAIR_MAGENTA : PAIR_GREEN));
+
+  for (int i = 0; i < arguments_count; i++)
+    free(all[i].output);
+  free(all);
+  free(fds);
+  free(fd_jobs);
+}
+
+void runParallel(char **params, int params_count) {
+  int jobs = sysconf(_SC_NPROCESSORS_ONLN), keep_order = FALSE, i = 0;
+  for (; i < params_count && params[i][0] == '-'; i++) {
+    if (strcmp(params[i], "-k") == 0) {
+      keep_order = TRUE;
+    } else if (params[i][1] == 'j') {
+      char *value = params[i][2] != '\0' ? &params[i][2] : (i + 1 < params_count ? params[++i] : NULL);
+      if (value == NULL || atoi(value) < 1) {
+        wprintw(p, "Niepoprawna wartosc opcji -j\n");
+        return;
+      }
+      jobs = atoi(value);
+    } else {
+      wprintw(p, "Nieznana opcja %s\n", params[i]);
+      return;
+    }
+  }
+
+  int command_start = i;
+  while (i < params_count && strcmp(params[i], ":::") != 0 && strcmp(params[i], "::::") != 0)
+    i++;
+  int command_count = i - command_start;
+  if (command_count == 0 || i == params_count) {
+    wprintw(p, "Uzycie: parallel [-j N] [-k] komenda [{}] ::: argumenty | :::: plik\n");
+    return;
+  }
+
+  struct word_list arguments = {NULL, 0, 0};
+  if (strcmp(params[i], ":::") == 0) {
+    for (int j = i + 1; j < params_count; j++)
+      wordListAdd(&arguments, strdup(params[j]));
+  } else {
+    // :::: plik => jeden argument na linie
+    for (int j = i + 1; j < params_count; j++) {
+      FILE *file = fopen(params[j], "r");
+      if (file == NULL) {
+        wprintw(p, "Brak pliku %s\n", params[j]);
+        wordListFree(&arguments);
+        return;
+      }
+      char *line = NULL;
+      size_t size = 0;
+      ssize_t length;
+      while ((length = getline(&line, &size, file)) != -1) {
+        if (length > 0 && line[length - 1] == '\n')
+          line[--length] = '\0';
+        if (length > 0)
+          wordListAdd(&arguments, strdup(line));
+      }
+      free(line);
+      fclose(file);
+    }
+  }
+
+  if (arguments.count > 0)
+    parallel(&params[command_start], command_count, arguments.words, arguments.count, jobs, keep_order);
+  wordListFree(&arguments);
+}
+
+int checkParams(int minimum_params, int maximum_params, int params_count) {
+  if (params_count < minimum_params) {
     wprintw(p, "%s (minimum %d)\n", NOT_ENOUGH_PARAMS, minimum_params, maximum_params);
     return 0;
   }
@@ -492,12 +2034,6 @@ int checkParams(int minimum_params, int maximum_params, int params_count) {
   return 1;
 }
 
-void append(char *str, char character) {
-  int lenght = strlen(str);
-  str[lenght] = character;
-  str[lenght + 1] = '\0';
-}
-
 int startsWith(char *source, char *prefix) {
   if (strlen(source) < strlen(prefix))
     return FALSE;
@@ -509,48 +2045,212 @@ int startsWith(char *source, char *prefix) {
   return TRUE;
 }
 
-void printBackspace() {
-  int y, x;
-  getyx(p, y, x);
-  mvwdelch(p, y, x - 1);
+// ZNAK ZACHETY
+// szablon jest parsowany raz na segmenty, cwd/login/host czytane tylko po
+// invalidatePrompt() (cd, export); galaz VCS liczy osobny watek z limitem czasu
+
+void invalidatePrompt() {
+  prompt.valid = FALSE;
 }
 
-int printPrompt() {
-  char *cwd = malloc(sizeof(char) * MAX_PATH);
+void addPromptSegment(int type, attr_t attributes, const char *text, size_t length) {
+  // kolejne kawalki tekstu o tych samych atrybutach laczymy w jeden segment
+  struct prompt_segment *last = prompt.segments_count > 0 ? &prompt.segments[prompt.segments_count - 1] : NULL;
+  if (type == SEGMENT_TEXT && last != NULL && last->type == SEGMENT_TEXT && last->attributes == attributes) {
+    size_t old_length = strlen(last->text);
+    last->text = realloc(last->text, old_length + length + 1);
+    memcpy(last->text + old_length, text, length);
+    last->text[old_length + length] = '\0';
+    return;
+  }
+
+  prompt.segments = realloc(prompt.segments, (prompt.segments_count + 1) * sizeof(struct prompt_segment));
+  prompt.segments[prompt.segments_count].type = type;
+  prompt.segments[prompt.segments_count].attributes = attributes;
+  prompt.segments[prompt.segments_count].text = strndup(text, length);
+  prompt.segments_count++;
+}
+
+int rebuildPrompt() {
+  char cwd[MAX_PATH];
   if (getcwd(cwd, MAX_PATH) == NULL) {
     wprintw(p, "Nie mozna wypisac znaku zachety (getcwd)");
-    free(cwd);
     return 1;
   }
 
-  char *login = calloc(32, sizeof(char));
-  getlogin_r(login, 32);
+  char login[32] = {'\0'};
+  if (getlogin_r(login, sizeof(login)) != 0 && getenv("USER") != NULL)
+    strncpy(login, getenv("USER"), sizeof(login) - 1);
+
+  char host[256] = {'\0'};
+  gethostname(host, sizeof(host) - 1);
 
-  if (has_colors() == FALSE) {
-    wprintw(p, "[%s:%s] $ ", login, cwd);
+  for (int i = 0; i < prompt.segments_count; i++)
+    free(prompt.segments[i].text);
+  prompt.segments_count = 0;
+  prompt.uses_vcs = FALSE;
+  strcpy(prompt.cwd, cwd);
+
+  char *template = getenv("PROMPT") != NULL ? getenv("PROMPT") : DEFAULT_PROMPT;
+  int colors = has_colors() == TRUE;
+  attr_t attributes = A_NORMAL;
+
+  for (char *c = template; *c != '\0'; c++) {
+    if (*c != '%' || c[1] == '\0') {
+      addPromptSegment(SEGMENT_TEXT, attributes, c, 1);
+      continue;
+    }
+
+    switch (*++c) {
+    case 'u': addPromptSegment(SEGMENT_TEXT, attributes, login, strlen(login)); break;
+    case 'h': addPromptSegment(SEGMENT_TEXT, attributes, host, strlen(host)); break;
+    case 'w': addPromptSegment(SEGMENT_TEXT, attributes, cwd, strlen(cwd)); break;
+    case 'W': {
+      char *base = strrchr(cwd, '/');
+      base = base != NULL && base[1] != '\0' ? base + 1 : cwd;
+      addPromptSegment(SEGMENT_TEXT, attributes, base, strlen(base));
+      break;
+    }
+    case 'v':
+      addPromptSegment(SEGMENT_VCS, attributes, "", 0);
+      prompt.uses_vcs = TRUE;
+      break;
+    case 'M': attributes = colors ? COLOR_PAIR(PAIR_MAGENTA) : A_NORMAL; break;
+    case 'G': attributes = colors ? COLOR_PAIR(PAIR_GREEN) : A_NORMAL; break;
+    case 'Y': attributes = colors ? COLOR_PAIR(PAIR_YELLOW) : A_NORMAL; break;
+    case 'B': attributes = colors ? COLOR_PAIR(PAIR_BLUE) | A_BOLD : A_NORMAL; break;
+    case 'C': attributes = colors ? COLOR_PAIR(PAIR_CYAN) : A_NORMAL; break;
+    case 'N': attributes = A_NORMAL; break;
+    default: addPromptSegment(SEGMENT_TEXT, attributes, c, 1); break; // %% i nieznane
+    }
+  }
+
+  prompt.valid = TRUE;
+  return 0;
+}
+
+// szuka .git w katalogu i wyzej, czyta HEAD bez uruchamiania gita
+void readVcsBranch(char *path, char *branch, size_t size) {
+  char dir[MAX_PATH], file[2 * MAX_PATH + 16], content[MAX_PATH];
+  strncpy(dir, path, MAX_PATH - 1);
+  dir[MAX_PATH - 1] = '\0';
+  branch[0] = '\0';
+
+  while (1) {
+    snprintf(file, sizeof(file), "%s/.git", strcmp(dir, "/") == 0 ? "" : dir);
+    int fd = -1;
+    if (isDir(file)) {
+      strcat(file, "/HEAD");
+      fd = open(file, O_RDONLY);
+    } else if ((fd = open(file, O_RDONLY)) != -1) {
+      // worktree: plik .git zawiera "gitdir: sciezka"
+      ssize_t num = read(fd, content, sizeof(content) - 1);
+      close(fd);
+      fd = -1;
+      content[num > 0 ? num : 0] = '\0';
+      content[strcspn(content, "\n")] = '\0';
+      if (startsWith(content, "gitdir: ")) {
+        if (content[8] == '/')
+          snprintf(file, sizeof(file), "%s/HEAD", &content[8]);
+        else
+          snprintf(file, sizeof(file), "%s/%s/HEAD", dir, &content[8]);
+        fd = open(file, O_RDONLY);
+      }
+    }
+
+    if (fd != -1) {
+      ssize_t num = read(fd, content, sizeof(content) - 1);
+      close(fd);
+      content[num > 0 ? num : 0] = '\0';
+      content[strcspn(content, "\n")] = '\0';
+      if (startsWith(content, "ref: refs/heads/"))
+        snprintf(branch, size, "%s", &content[16]);
+      else
+        snprintf(branch, size, "%.7s", content); // odlaczony HEAD => skrot hasha
+      return;
+    }
+
+    char *slash = strrchr(dir, '/');
+    if (slash == NULL || strcmp(dir, "/") == 0)
+      return;
+    if (slash == dir)
+      slash[1] = '\0';
+    else
+      *slash = '\0';
+  }
+}
+
+void *vcsWorker(void *argument) {
+  char *path = argument;
+  char branch[VCS_BRANCH_SIZE];
+  readVcsBranch(path, branch, sizeof(branch));
+
+  pthread_mutex_lock(&vcs.mutex);
+  strcpy(vcs.path, path);
+  strcpy(vcs.branch, branch);
+  vcs.running = FALSE;
+  pthread_cond_broadcast(&vcs.done);
+  pthread_mutex_unlock(&vcs.mutex);
+
+  free(path);
+  return NULL;
+}
+
+void refreshVcs() {
+  pthread_mutex_lock(&vcs.mutex);
+
+  // poprzednie zapytanie wciaz wisi (np. wolny NFS) => nie dokladamy kolejnego
+  // i nie czekamy, na ekranie zostaje ostatni znany branch
+  if (vcs.running) {
+    pthread_mutex_unlock(&vcs.mutex);
+    return;
+  }
+
+  pthread_t thread;
+  vcs.running = TRUE;
+  if (pthread_create(&thread, NULL, vcsWorker, strdup(prompt.cwd)) == 0) {
+    pthread_detach(thread);
   } else {
-    wattron(p, COLOR_PAIR(PAIR_MAGENTA));
-    waddch(p, '[');
-    wattroff(p, COLOR_PAIR(PAIR_MAGENTA));
-    wattron(p, COLOR_PAIR(PAIR_GREEN));
-    wprintw(p, login);
-    wattroff(p, COLOR_PAIR(PAIR_GREEN));
-    waddch(p, ':');
-    wattron(p, COLOR_PAIR(PAIR_YELLOW));
-    wprintw(p, cwd);
-    wattroff(p, COLOR_PAIR(PAIR_YELLOW));
-    wattron(p, COLOR_PAIR(PAIR_MAGENTA));
-    waddch(p, ']');
-    wattroff(p, COLOR_PAIR(PAIR_MAGENTA));
-    wattron(p, COLOR_PAIR(PAIR_BLUE));
-    wattron(p, A_BOLD);
-    wprintw(p, " $ ");
-    wattroff(p, A_BOLD);
-    wattroff(p, COLOR_PAIR(PAIR_BLUE));
+    vcs.running = FALSE;
+    pthread_mutex_unlock(&vcs.mutex);
+    return;
   }
 
-  free(cwd);
-  free(login);
+  struct timespec deadline;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_nsec += VCS_TIMEOUT_MS * 1000000L;
+  deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+  deadline.tv_nsec %= 1000000000L;
+
+  while (vcs.running)
+    if (pthread_cond_timedwait(&vcs.done, &vcs.mutex, &deadline) == ETIMEDOUT)
+      break;
+
+  pthread_mutex_unlock(&vcs.mutex);
+}
+
+int printPrompt() {
+  if (!prompt.valid && rebuildPrompt())
+    return 1;
+
+  if (prompt.uses_vcs)
+    refreshVcs();
+
+  for (int i = 0; i < prompt.segments_count; i++) {
+    struct prompt_segment *segment = &prompt.segments[i];
+    wattrset(p, segment->attributes);
+
+    if (segment->type == SEGMENT_TEXT) {
+      waddstr(p, segment->text);
+    } else {
+      // po przekroczeniu limitu czasu zostaje ostatni wynik dla tego katalogu
+      pthread_mutex_lock(&vcs.mutex);
+      if (strcmp(vcs.path, prompt.cwd) == 0 && strlen(vcs.branch) > 0)
+        wprintw(p, " (%s)", vcs.branch);
+      pthread_mutex_unlock(&vcs.mutex);
+    }
+  }
+  wattrset(p, A_NORMAL);
 
   scrollDown();
 
@@ -559,7 +2259,17 @@ int printPrompt() {
 
 void refreshTerminal() {
   wrefresh(w);
-  prefresh(p, scrolled_rows, 0, 0, 0, view_rows - 1, view_cols - 1);
+  if (fuzzy_popup == NULL) {
+    prefresh(p, scrolled_rows, 0, 0, 0, view_rows - 1, view_cols - 1);
+    return;
+  }
+
+  // okienko podpowiedzi nad padem, kursor zostaje w linii polecenia
+  pnoutrefresh(p, scrolled_rows, 0, 0, 0, view_rows - 1, view_cols - 1);
+  touchwin(fuzzy_popup);
+  wnoutrefresh(fuzzy_popup);
+  setsyx(getcury(p) - scrolled_rows, getcurx(p));
+  doupdate();
 }
 
 void scrollDown() {
@@ -568,13 +2278,6 @@ void scrollDown() {
   curs_set(1);
 }
 
-void clearLineAfter(int y, int x) {
-  // wyczysc dotychczas wpisany tekst
-  wmove(p, y, x); // przesun kursor
-  wclrtoeol(p);
-  refreshTerminal();
-}
-
 void execute(char **arguments) {
   if (execvp(arguments[0], arguments) == -1) {
     switch (errno) {
@@ -593,7 +2296,7 @@ void execute(char **arguments) {
     }
     putchar('\n');
   }
-  exit(EXIT_SUCCESS);
+  exit(EXIT_FAILURE);
 }
 
 void printHistory() {
@@ -629,9 +2332,11 @@ void cd(char *path) {
       return;
     }
 
-    strcpy(path, getenv("HOME"));
+    path = getenv("HOME");
   }
 
+  // parametry maja dokladnie tyle pamieci ile tekstu, wiec sciezke kopiujemy lokalnie
+  char target[MAX_PATH] = {'\0'};
   if (strcmp(path, "-") == 0) {
     if (strlen(previous_path) == 0) {
       wprintw(p, "Brak poprzedniej sciezki");
@@ -639,15 +2344,19 @@ void cd(char *path) {
       return;
     }
 
-    strcpy(path, previous_path);
+    strcpy(target, previous_path);
+  } else {
+    strncpy(target, path, MAX_PATH - 1);
   }
 
   previous_path[0] = '\0';
   if (getcwd(previous_path, MAX_PATH) == NULL)
     wprintw(p, "Nie mozna pobrac sciezki");
 
-  if (chdir(path) != 0)
+  if (chdir(target) != 0)
     wprintw(p, "chdir() failed");
+  else
+    invalidatePrompt();
 }
 
 int isDir(const char *path) {
@@ -657,144 +2366,1265 @@ int isDir(const char *path) {
   return false;
 }
 
-void cpFile(char *source, char *dest, int override) {
-  int fd_in, fd_out, num;
-  char buffer[BUFFER_SIZE];
+// WALKER
+// wielowatkowe przechodzenie drzewa katalogow: watki zabieraja katalogi ze
+// wspolnego stosu, czytaja je przez getdents64, a stat robia tylko gdy d_type
+// nie wystarcza albo callback o niego poprosi (walkStat)
+
+struct stat *walkStat(struct walk_entry *entry) {
+  if (!entry->has_stat && fstatat(entry->dirfd, entry->name, &entry->st, AT_SYMLINK_NOFOLLOW) == 0)
+    entry->has_stat = TRUE;
+  return entry->has_stat ? &entry->st : NULL;
+}
+
+void walkAppend(struct walk_output *output, const char *text, size_t length) {
+  if (output->length + length > output->capacity) {
+    output->capacity = output->length + length + WALK_OUTPUT_FLUSH;
+    output->data = realloc(output->data, output->capacity);
+  }
+  memcpy(output->data + output->length, text, length);
+  output->length += length;
+}
 
-  if (access(source, F_OK) != 0) {
-    wprintw(p, "Brak pliku zrodlowego %s\n", source);
+// bufory watkow sa oprozniane do spoola partiami, pod wspolna blokada; tylko
+// na granicy rekordow, zeby linie roznych watkow sie nie przeplataly
+void walkFlushIfFull(struct walk_entry *entry, struct walk_output *output) {
+  if (output->length >= WALK_OUTPUT_FLUSH) {
+    pthread_mutex_lock(&entry->walker->mutex);
+    spoolWrite(output->data, output->length);
+    pthread_mutex_unlock(&entry->walker->mutex);
+    output->length = 0;
+  }
+}
+
+// text to caly rekord (zwykle linia zakonczona '\n')
+void walkOutput(struct walk_entry *entry, const char *text, size_t length) {
+  struct walk_output *output = &entry->walker->outputs[entry->thread];
+  walkAppend(output, text, length);
+  walkFlushIfFull(entry, output);
+}
+
+void walkOutputLine(struct walk_entry *entry, const char *text) {
+  struct walk_output *output = &entry->walker->outputs[entry->thread];
+  walkAppend(output, text, strlen(text));
+  walkAppend(output, "\n", 1);
+  walkFlushIfFull(entry, output);
+}
+
+void walkPush(struct walker *walker, struct word_list *directories) {
+  if (directories->count == 0)
     return;
+
+  pthread_mutex_lock(&walker->mutex);
+  if (walker->queue.count + directories->count > walker->queue.capacity) {
+    walker->queue.capacity = (walker->queue.count + directories->count) * 2;
+    walker->queue.words = realloc(walker->queue.words, walker->queue.capacity * sizeof(char *));
   }
+  memcpy(walker->queue.words + walker->queue.count, directories->words, directories->count * sizeof(char *));
+  walker->queue.count += directories->count;
+  pthread_cond_broadcast(&walker->work);
+  pthread_mutex_unlock(&walker->mutex);
 
-  if (access(dest, F_OK) == 0 && !override)
+  directories->count = 0;
+}
+
+void walkDirectory(struct walker *walker, int thread, char *path, char *buffer) {
+  int fd = open(path, O_RDONLY | O_DIRECTORY);
+  if (fd == -1) {
+    atomic_fetch_add(&walker->errors, 1);
     return;
+  }
+
+  struct word_list directories = {NULL, 0, 0};
+  size_t path_length = strlen(path), fullpath_capacity = path_length + 256;
+  char *fullpath = malloc(fullpath_capacity);
+  memcpy(fullpath, path, path_length);
+  if (path_length == 0 || path[path_length - 1] != '/')
+    fullpath[path_length++] = '/';
+
+  long num;
+  while ((num = syscall(SYS_getdents64, fd, buffer, WALK_BUFFER_SIZE)) > 0) {
+    for (long offset = 0; offset < num;) {
+      struct linux_dirent64 *dirent = (struct linux_dirent64 *)(buffer + offset);
+      offset += dirent->d_reclen;
+
+      if (strcmp(dirent->d_name, ".") == 0 || strcmp(dirent->d_name, "..") == 0)
+        continue;
+
+      size_t name_length = strlen(dirent->d_name);
+      if (path_length + name_length + 1 > fullpath_capacity) {
+        fullpath_capacity = (path_length + name_length + 1) * 2;
+        fullpath = realloc(fullpath, fullpath_capacity);
+      }
+      memcpy(fullpath + path_length, dirent->d_name, name_length + 1);
+
+      struct walk_entry entry = {walker, thread, fd, dirent->d_name, fullpath, dirent->d_type, FALSE};
+      if (entry.type == DT_UNKNOWN) {
+        struct stat *st = walkStat(&entry);
+        entry.type = st == NULL ? DT_UNKNOWN : IFTODT(st->st_mode);
+      }
+
+      if (walker->callback(&entry) && entry.type == DT_DIR)
+        wordListAdd(&directories, strdup(fullpath));
+
+      // duze katalogi oddaja podkatalogi wczesniej, zeby inne watki nie czekaly
+      if (directories.count >= WALK_PUSH_BATCH)
+        walkPush(walker, &directories);
+    }
+  }
+
+  walkPush(walker, &directories);
+  free(directories.words);
+  free(fullpath);
+  close(fd);
+}
+
+void *walkThread(void *argument) {
+  struct walk_thread *self = argument;
+  struct walker *walker = self->walker;
+  char *buffer = malloc(WALK_BUFFER_SIZE);
+
+  pthread_mutex_lock(&walker->mutex);
+  while (TRUE) {
+    if (walker->queue.count > 0) {
+      char *path = walker->queue.words[--walker->queue.count];
+      pthread_mutex_unlock(&walker->mutex);
+      walkDirectory(walker, self->index, path, buffer);
+      free(path);
+      pthread_mutex_lock(&walker->mutex);
+      continue;
+    }
+
+    if (walker->finished)
+      break;
+
+    // pusty stos i wszyscy czekaja => nikt juz nie doda pracy
+    if (++walker->waiting == walker->threads) {
+      walker->finished = TRUE;
+      pthread_cond_broadcast(&walker->work);
+      break;
+    }
+    pthread_cond_wait(&walker->work, &walker->mutex);
+    walker->waiting--;
+  }
+  pthread_mutex_unlock(&walker->mutex);
+
+  free(buffer);
+  return NULL;
+}
 
-  fd_in = open(source, O_RDONLY);
-  fd_out = open(dest, O_WRONLY | O_CREAT);
-  while ((num = read(fd_in, &buffer, BUFFER_SIZE)) > 0)
-    write(fd_out, &buffer, num);
+// zwraca liczbe katalogow, ktorych nie dalo sie otworzyc, albo -1 gdy brak root
+long walkTree(char *root, walk_callback callback, void *context, int threads) {
+  struct walker walker;
+  memset(&walker, 0, sizeof(walker));
+  walker.callback = callback;
+  walker.context = context;
+  walker.threads = threads < 1 ? 1 : threads;
+  walker.outputs = calloc(walker.threads, sizeof(struct walk_output));
+  atomic_init(&walker.errors, 0);
+  pthread_mutex_init(&walker.mutex, NULL);
+  pthread_cond_init(&walker.work, NULL);
+
+  struct walk_entry entry = {&walker, 0, AT_FDCWD, root, root, DT_UNKNOWN, FALSE};
+  if (stat(root, &entry.st) != 0) {
+    free(walker.outputs);
+    return -1;
+  }
+  entry.has_stat = TRUE;
+  entry.type = IFTODT(entry.st.st_mode);
+
+  if (callback(&entry) && entry.type == DT_DIR) {
+    struct word_list directories = {NULL, 0, 0};
+    wordListAdd(&directories, strdup(root));
+    walkPush(&walker, &directories);
+    free(directories.words);
+
+    struct walk_thread *workers = malloc(walker.threads * sizeof(struct walk_thread));
+    pthread_t *handles = malloc(walker.threads * sizeof(pthread_t));
+    for (int i = 0; i < walker.threads; i++) {
+      workers[i].walker = &walker;
+      workers[i].index = i;
+      if (i > 0)
+        pthread_create(&handles[i], NULL, walkThread, &workers[i]);
+    }
+    walkThread(&workers[0]);
+    for (int i = 1; i < walker.threads; i++)
+      pthread_join(handles[i], NULL);
+    free(workers);
+    free(handles);
+  }
+
+  for (int i = 0; i < walker.threads; i++) {
+    spoolWrite(walker.outputs[i].data, walker.outputs[i].length);
+    free(walker.outputs[i].data);
+  }
+  free(walker.outputs);
+  free(walker.queue.words);
+  pthread_mutex_destroy(&walker.mutex);
+  pthread_cond_destroy(&walker.work);
+  return atomic_load(&walker.errors);
+}
+
+// zwraca 0 albo kod CP_*; plik docelowy dostaje prawa zrodla
+int cpFile(char *source, char *dest, int override) {
+  char buffer[BUFFER_SIZE];
+
+  if (access(source, F_OK) != 0)
+    return CP_NO_SOURCE;
+
+  if (access(dest, F_OK) == 0 && !override)
+    return 0;
+
+  int fd_in = open(source, O_RDONLY);
+  struct stat st;
+  if (fd_in == -1 || fstat(fd_in, &st) == -1) {
+    if (fd_in != -1) close(fd_in);
+    return CP_OPEN_SOURCE;
+  }
+
+  int fd_out = open(dest, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (fd_out == -1) {
+    close(fd_in);
+    return CP_OPEN_DEST;
+  }
+
+  int error = 0;
+  while (error == 0) {
+    ssize_t num = read(fd_in, buffer, BUFFER_SIZE);
+    if (num == 0)
+      break;
+    if (num == -1) {
+      if (errno != EINTR)
+        error = CP_READ;
+      continue;
+    }
+
+    // write() moze zapisac mniej, niz dostal (np. przy zapelnionym dysku)
+    ssize_t written = 0;
+    while (error == 0 && written < num) {
+      ssize_t count = write(fd_out, buffer + written, num - written);
+      if (count > 0)
+        written += count;
+      else if (count == 0 || errno != EINTR)
+        error = CP_WRITE;
+    }
+  }
+
+  if (error == 0)
+    fchmod(fd_out, st.st_mode);
   close(fd_in);
-  close(fd_out);
+  if (close(fd_out) == -1 && error == 0)
+    error = CP_WRITE;
+  return error;
+}
+
+// dowiazania symboliczne odtwarzamy jako dowiazania: kopiowanie przez nie
+// zrobiloby z dowiazania do katalogu pusty plik, a petle nie mialyby konca
+int cpLink(const char *source, char *dest, int override) {
+  char target[MAX_PATH];
+  ssize_t length = readlink(source, target, sizeof(target) - 1);
+  if (length == -1)
+    return CP_NO_SOURCE;
+  target[length] = '\0';
+
   struct stat st;
-  stat(source, &st);
-  chmod(dest, st.st_mode);
+  if (lstat(dest, &st) == 0) {
+    if (!override)
+      return 0;
+    unlink(dest);
+  }
+  return symlink(target, dest) == 0 ? 0 : CP_LINK;
+}
+
+const char *cpErrorText(int error) {
+  switch (error) {
+  case CP_NO_SOURCE:
+    return "brak pliku zrodlowego";
+  case CP_OPEN_SOURCE:
+    return "nie mozna otworzyc pliku zrodlowego";
+  case CP_OPEN_DEST:
+    return "nie mozna utworzyc pliku docelowego";
+  case CP_READ:
+    return "blad odczytu";
+  case CP_WRITE:
+    return "blad zapisu";
+  default:
+    return "nie mozna utworzyc dowiazania";
+  }
 }
 
-void cp(char *source, char *dest, int recursive, int override, int is_first_call) {
-  if (isDir(source)) {
-    if (!recursive) {
-      cpFile(source, dest, override);
+int cpCallback(struct walk_entry *entry) {
+  struct cp_context *context = entry->walker->context;
+  // przy zrodle "src/" sciezka wzgledna nie zaczyna sie od '/', wiec
+  // separator dokleja joinPath()
+  char *relative = (char *)entry->path + context->source_length;
+  while (*relative == '/')
+    relative++;
+  char *fullpath_dest = strlen(relative) > 0 ? joinPath(context->dest, relative) : strdup(context->dest);
+
+  char message[2 * MAX_PATH];
+  int descend = FALSE, error = 0;
+
+  if (entry->type == DT_DIR) {
+    struct stat *st = walkStat(entry);
+    if (!isDir(fullpath_dest) && mkdir(fullpath_dest, st != NULL ? st->st_mode : 0777) == -1) {
+      int length = snprintf(message, sizeof(message), "Nie mozna stworzyc folderu %s\n", fullpath_dest);
+      walkOutput(entry, message, length);
+      free(fullpath_dest);
+      return FALSE;
+    }
+    descend = TRUE;
+  } else if (entry->type == DT_LNK) {
+    error = cpLink(entry->path, fullpath_dest, context->override);
+  } else {
+    error = cpFile((char *)entry->path, fullpath_dest, context->override);
+  }
+
+  if (error != 0) {
+    int length = snprintf(message, sizeof(message), "Nie mozna skopiowac %s: %s\n", entry->path, cpErrorText(error));
+    walkOutput(entry, message, length);
+  } else if (strlen(relative) > 0) {
+    int length = snprintf(message, sizeof(message), "%s -> %s\n", entry->path, fullpath_dest);
+    walkOutput(entry, message, length);
+  }
+
+  free(fullpath_dest);
+  return descend;
+}
+
+void cp(char *source, char *dest, int recursive, int override) {
+  if (isDir(source) && recursive) {
+    // podkatalog powstaje w callbacku, zanim walker zacznie czytac jego zawartosc
+    struct cp_context context = {source, strlen(source), dest, override};
+    spoolBegin();
+    walkTree(source, cpCallback, &context, sysconf(_SC_NPROCESSORS_ONLN));
+    spoolEnd();
+  } else if (access(source, F_OK) == 0) {
+    int error = cpFile(source, dest, override);
+    if (error != 0)
+      wprintw(p, "Nie mozna skopiowac %s: %s\n", source, cpErrorText(error));
+  } else {
+    wprintw(p, "Nie ma takiego pliku\n");
+  }
+}
+
+// FIND
+
+int compareWithSign(long long value, long long expected, int sign) {
+  if (sign > 0) return value > expected;
+  if (sign < 0) return value < expected;
+  return value == expected;
+}
+
+int findCallback(struct walk_entry *entry) {
+  struct find_options *options = entry->walker->context;
+
+  if (options->type != 0) {
+    char type = entry->type == DT_DIR ? 'd' : entry->type == DT_LNK ? 'l' : entry->type == DT_REG ? 'f' : '?';
+    if (type != options->type)
+      return TRUE;
+  }
+
+  if (options->has_name) {
+    const char *name = strrchr(entry->name, '/') != NULL && entry->dirfd == AT_FDCWD ? strrchr(entry->name, '/') + 1 : entry->name;
+    if (!globMatch(options->name_ops, options->name_ops_count, name))
+      return TRUE;
+  }
+
+  // stat tylko dla -size i -mtime
+  if (options->has_size || options->has_mtime) {
+    struct stat *st = walkStat(entry);
+    if (st == NULL)
+      return TRUE;
+    if (options->has_size && !compareWithSign((st->st_size + options->size_unit - 1) / options->size_unit, options->size, options->size_sign))
+      return TRUE;
+    if (options->has_mtime && !compareWithSign((options->now - st->st_mtime) / 86400, options->mtime, options->mtime_sign))
+      return TRUE;
+  }
+
+  walkOutputLine(entry, entry->path);
+  return TRUE;
+}
+
+// "+N" => 1, "-N" => -1, "N" => 0
+int parseSign(char **value) {
+  if (**value == '+') { (*value)++; return 1; }
+  if (**value == '-') { (*value)++; return -1; }
+  return 0;
+}
+
+void find(char **params, int params_count) {
+  struct find_options options;
+  memset(&options, 0, sizeof(options));
+  options.now = time(NULL);
+  char *root = ".";
+  int threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+  for (int i = 0; i < params_count; i++) {
+    if (params[i][0] != '-') {
+      root = params[i];
+      continue;
+    }
+
+    char *value = i + 1 < params_count ? params[i + 1] : NULL;
+    if (value == NULL) {
+      wprintw(p, "Brak wartosci opcji %s\n", params[i]);
+      return;
+    }
+    i++;
+
+    if (strcmp(params[i - 1], "-name") == 0) {
+      char *active = malloc(strlen(value) + 1);
+      memset(active, 1, strlen(value) + 1);
+      free(options.name_ops);
+      options.name_ops = globCompile(value, active, strlen(value), &options.name_ops_count);
+      options.has_name = TRUE;
+      free(active);
+    } else if (strcmp(params[i - 1], "-type") == 0 && strlen(value) == 1 && strchr("fdl", value[0]) != NULL) {
+      options.type = value[0];
+    } else if (strcmp(params[i - 1], "-size") == 0) {
+      options.size_sign = parseSign(&value);
+      char *unit;
+      options.size = strtoll(value, &unit, 10);
+      options.size_unit = 512; // jak w GNU find: domyslnie bloki 512 bajtow
+      if (*unit == 'c') options.size_unit = 1;
+      else if (*unit == 'k') options.size_unit = 1024;
+      else if (*unit == 'M') options.size_unit = 1024 * 1024;
+      else if (*unit == 'G') options.size_unit = 1024 * 1024 * 1024;
+      options.has_size = TRUE;
+    } else if (strcmp(params[i - 1], "-mtime") == 0) {
+      options.mtime_sign = parseSign(&value);
+      options.mtime = atol(value);
+      options.has_mtime = TRUE;
+    } else if (strcmp(params[i - 1], "-j") == 0 && atoi(value) > 0) {
+      threads = atoi(value);
+    } else {
+      wprintw(p, "Niepoprawna opcja %s %s\n", params[i - 1], value);
+      free(options.name_ops);
       return;
     }
+  }
 
-    DIR *dir;
-    struct dirent *entry;
-    struct stat st;
+  spoolBegin();
+  long errors = walkTree(root, findCallback, &options, threads);
+  spoolEnd();
 
-    if (!isDir(dest)) {
-      stat(source, &st);
-      if(mkdir(dest, st.st_mode) == -1) {
-        wprintw(p, "Nie mozna stworzyc folderu %s\n", dest);
-        return;
+  if (errors == -1)
+    wprintw(p, "Brak pliku %s\n", root);
+  else if (errors > 0)
+    wprintw(p, "Nie mozna otworzyc %ld katalogow\n", errors);
+  free(options.name_ops);
+}
+
+// SPOOL
+// pelne wyjscie ostatniej komendy trafia do niewidocznego pliku tymczasowego,
+// na ekranie zostaje tylko jego koncowka; reszta jest dostepna przez scrollback()
+
+void spoolBegin() {
+  spoolClose();
+
+  // plik anonimowy w $TMPDIR, niedziedziczony przez uruchamiane komendy
+  char *directory = getenv("TMPDIR");
+  if (directory == NULL || directory[0] == '\0')
+    directory = "/tmp";
+  output_spool.fd = open(directory, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+  if (output_spool.fd == -1) {
+    // system plikow bez O_TMPFILE => zwykly plik usuwany zaraz po utworzeniu
+    char *path = joinPath(directory, "shell-spool-XXXXXX");
+    output_spool.fd = mkostemp(path, O_CLOEXEC);
+    if (output_spool.fd != -1)
+      unlink(path);
+    free(path);
+  }
+
+  output_spool.lines_capacity = 1024;
+  output_spool.lines = malloc(output_spool.lines_capacity * sizeof(size_t));
+  output_spool.lines[0] = 0;
+}
+
+void spoolClose() {
+  if (output_spool.map != NULL)
+    munmap(output_spool.map, output_spool.map_size);
+  if (output_spool.fd != -1)
+    close(output_spool.fd);
+  free(output_spool.lines);
+  memset(&output_spool, 0, sizeof(output_spool));
+  output_spool.fd = -1;
+}
+
+void spoolWriteAll(const char *data, size_t length) {
+  size_t written = 0;
+  while (written < length) {
+    ssize_t num = write(output_spool.fd, data + written, length - written);
+    if (num <= 0)
+      break;
+    written += num;
+  }
+}
+
+void spoolFlush() {
+  spoolWriteAll(output_spool.buffer, output_spool.buffered);
+  output_spool.buffered = 0;
+}
+
+void spoolWrite(const char *data, size_t length) {
+  if (output_spool.fd == -1)
+    return;
+
+  // indeks jest rzadki: zapamietujemy poczatek co SPOOL_INDEX_STEP-tej linii
+  const char *cur = data, *end = data + length, *newline;
+  while ((newline = memchr(cur, '\n', end - cur)) != NULL) {
+    output_spool.newlines++;
+    if (output_spool.newlines % SPOOL_INDEX_STEP == 0) {
+      if (output_spool.lines_count + 1 == output_spool.lines_capacity) {
+        output_spool.lines_capacity *= 2;
+        output_spool.lines = realloc(output_spool.lines, output_spool.lines_capacity * sizeof(size_t));
       }
+      output_spool.lines[++output_spool.lines_count] = output_spool.size + (newline - data) + 1;
     }
+    cur = newline + 1;
+  }
+  output_spool.size += length;
+  if (length > 0)
+    output_spool.partial_line = data[length - 1] != '\n';
 
-    if ((dir = opendir(source)) != NULL) {
-      while ((entry = readdir(dir)) != NULL) {
-        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
-          continue;
+  if (output_spool.buffered + length > SPOOL_BUFFER_SIZE)
+    spoolFlush();
 
-        char *fullpath_source = malloc(strlen(source) + strlen(entry->d_name) + 2);
-        char *fullpath_dest = malloc(strlen(dest) + strlen(entry->d_name) + 2);
-        sprintf(fullpath_source, "%s/%s", source, entry->d_name);
-        sprintf(fullpath_dest, "%s/%s", dest, entry->d_name);
-        if (isDir(fullpath_source)) {
-          if (!isDir(fullpath_dest)) {
-            stat(fullpath_source, &st);
-            if(mkdir(fullpath_dest, st.st_mode) == -1) {
-              wprintw(p, "Nie mozna stworzyc folderu %s\n", fullpath_dest);
-              free(fullpath_source);
-              free(fullpath_dest);
-              return;
-            }
-          }
-          cp(fullpath_source, fullpath_dest, recursive, override, 0);
-        } else {
-          cpFile(fullpath_source, fullpath_dest, override);
-        }
-        wprintw(p, "%s -> %s\n", fullpath_source, fullpath_dest);
-        free(fullpath_source);
-        free(fullpath_dest);
+  if (length > SPOOL_BUFFER_SIZE) {
+    spoolWriteAll(data, length);
+  } else {
+    memcpy(output_spool.buffer + output_spool.buffered, data, length);
+    output_spool.buffered += length;
+  }
+}
+
+size_t spoolLinesCount() {
+  return output_spool.newlines + (output_spool.partial_line ? 1 : 0);
+}
+
+char *spoolMap() {
+  if (output_spool.fd == -1 || output_spool.size == 0)
+    return NULL;
+
+  spoolFlush();
+  if (output_spool.map != NULL && output_spool.map_size == output_spool.size)
+    return output_spool.map;
+
+  if (output_spool.map != NULL)
+    munmap(output_spool.map, output_spool.map_size);
+  output_spool.map = mmap(NULL, output_spool.size, PROT_READ, MAP_SHARED, output_spool.fd, 0);
+  if (output_spool.map == MAP_FAILED) {
+    output_spool.map = NULL;
+    return NULL;
+  }
+  output_spool.map_size = output_spool.size;
+  return output_spool.map;
+}
+
+size_t spoolLineOffset(size_t line) {
+  size_t offset = output_spool.lines[line / SPOOL_INDEX_STEP];
+  for (size_t i = line % SPOOL_INDEX_STEP; i > 0; i--) {
+    char *newline = memchr(output_spool.map + offset, '\n', output_spool.size - offset);
+    if (newline == NULL)
+      return output_spool.size;
+    offset = newline - output_spool.map + 1;
+  }
+  return offset;
+}
+
+size_t spoolLineAt(size_t offset) {
+  // binarnie po indeksie, potem liczenie '\n' od najblizszego punktu kontrolnego
+  size_t low = 0, high = output_spool.lines_count;
+  while (low < high) {
+    size_t middle = (low + high + 1) / 2;
+    if (output_spool.lines[middle] <= offset)
+      low = middle;
+    else
+      high = middle - 1;
+  }
+  return low * SPOOL_INDEX_STEP + countNewlines(output_spool.map + output_spool.lines[low], offset - output_spool.lines[low]);
+}
+
+size_t spoolLineEnd(size_t offset) {
+  char *newline = memchr(output_spool.map + offset, '\n', output_spool.size - offset);
+  return newline == NULL ? output_spool.size : (size_t)(newline - output_spool.map);
+}
+
+size_t spoolTailLines() {
+  return view_rows > 3 ? view_rows - 2 : 1;
+}
+
+void printSpoolNote(size_t skipped) {
+  if (has_colors() == TRUE) wattron(p, COLOR_PAIR(PAIR_CYAN));
+  wprintw(p, "[... %zu linii wyzej, PgUp lub scrollback aby przegladac]\n", skipped);
+  if (has_colors() == TRUE) wattroff(p, COLOR_PAIR(PAIR_CYAN));
+}
+
+void spoolEnd() {
+  size_t lines_count = spoolLinesCount(), tail = spoolTailLines();
+  if (spoolMap() == NULL)
+    return;
+
+  size_t first = 0;
+  if (lines_count > tail) {
+    first = lines_count - tail;
+    printSpoolNote(first);
+  }
+
+  size_t offset = spoolLineOffset(first);
+  waddnstr(p, output_spool.map + offset, output_spool.size - offset);
+}
+
+void drawScrollbackLine(int row, size_t start, size_t end, struct matcher *m) {
+  wmove(w, row, 0);
+  if (end - start > (size_t)view_cols)
+    end = start + view_cols;
+
+  // podswietl wszystkie trafienia wyszukiwanego wzorca w linii
+  size_t position = start;
+  regmatch_t range;
+  while (m != NULL && position < end) {
+    range.rm_so = position;
+    range.rm_eo = end;
+    if (regexec(&m->regex, output_spool.map, 1, &range, REG_STARTEND | (position > start ? REG_NOTBOL : 0)) != 0 || range.rm_eo == range.rm_so)
+      break;
+
+    waddnstr(w, output_spool.map + position, range.rm_so - position);
+    wattron(w, A_REVERSE);
+    waddnstr(w, output_spool.map + range.rm_so, range.rm_eo - range.rm_so);
+    wattroff(w, A_REVERSE);
+    position = range.rm_eo;
+  }
+
+  waddnstr(w, output_spool.map + position, end - position);
+  wclrtoeol(w);
+}
+
+int readScrollbackPattern(char *pattern) {
+  int length = 0;
+  pattern[0] = '\0';
+  while (1) {
+    mvwprintw(w, view_rows - 1, 0, "/%s", pattern);
+    wclrtoeol(w);
+    wrefresh(w);
+
+    int charcode = wgetch(w);
+    if (charcode == '\n')
+      return length > 0;
+    if (charcode == 27) // ESC
+      return FALSE;
+    if ((charcode == KEY_BACKSPACE || charcode == 127) && length > 0)
+      pattern[--length] = '\0';
+    else if (isprint(charcode) && length < MAX_PATH - 1) {
+      pattern[length++] = charcode;
+      pattern[length] = '\0';
+    }
+  }
+}
+
+// szukanie wstecz oknami po SCROLLBACK_SEARCH_WINDOW bajtow od end w strone
+// poczatku: w oknie matcher idzie do przodu i zapamietuje ostatnie trafienie;
+// miedzy oknami ESC przerywa szukanie (wynik -1)
+int scrollbackFindBackward(struct matcher *m, size_t end, size_t *found) {
+  int result = FALSE;
+  nodelay(w, TRUE);
+  while (end > 0 && !result) {
+    size_t start = end > SCROLLBACK_SEARCH_WINDOW ? end - SCROLLBACK_SEARCH_WINDOW : 0;
+    if (start > 0) {
+      char *newline = memrchr(output_spool.map, '\n', start);
+      start = newline == NULL ? 0 : (size_t)(newline - output_spool.map) + 1;
+    }
+
+    size_t position = start, line_start, line_end;
+    while (position < end && matcherFindLine(m, output_spool.map, position, end, &line_start, &line_end)) {
+      *found = line_start;
+      result = TRUE;
+      position = line_end + 1;
+    }
+
+    end = start;
+    if (!result && wgetch(w) == 27)
+      result = -1;
+  }
+  nodelay(w, FALSE);
+  return result;
+}
+
+void scrollback() {
+  if (spoolMap() == NULL) {
+    wprintw(p, "Brak zapisanego wyjscia komendy\n");
+    return;
+  }
+
+  size_t lines_count = spoolLinesCount();
+  size_t page = view_rows > 1 ? view_rows - 1 : 1;
+  size_t top = lines_count > page ? lines_count - page : 0;
+  char pattern[MAX_PATH] = {'\0'}, status[MAX_PATH] = {'\0'};
+  struct matcher m;
+  int has_matcher = FALSE;
+
+  keypad(w, TRUE);
+  curs_set(0);
+
+  while (1) {
+    werase(w);
+    size_t offset = spoolLineOffset(top);
+    for (size_t row = 0; row < page && top + row < lines_count; row++) {
+      size_t end = spoolLineEnd(offset);
+      drawScrollbackLine(row, offset, end, has_matcher ? &m : NULL);
+      offset = end + 1;
+    }
+
+    wattron(w, A_REVERSE);
+    mvwprintw(w, view_rows - 1, 0, " %zu-%zu/%zu  / szukaj  n/N nastepne/poprzednie  q wyjscie %s",
+              top + 1, top + page < lines_count ? top + page : lines_count, lines_count, status);
+    wattroff(w, A_REVERSE);
+    wclrtoeol(w);
+    wrefresh(w);
+    status[0] = '\0';
+
+    int charcode = wgetch(w);
+    if (charcode == 'q' || charcode == 27)
+      break;
+
+    switch (charcode) {
+    case KEY_UP:
+    case 'k':
+      if (top > 0) top--;
+      break;
+    case KEY_DOWN:
+    case 'j':
+      if (top + page < lines_count) top++;
+      break;
+    case KEY_PPAGE:
+    case 'b':
+      top = top > page ? top - page : 0;
+      break;
+    case KEY_NPAGE:
+    case ' ':
+      top = top + 2 * page < lines_count ? top + page : (lines_count > page ? lines_count - page : 0);
+      break;
+    case KEY_HOME:
+    case 'g':
+      top = 0;
+      break;
+    case KEY_END:
+    case 'G':
+      top = lines_count > page ? lines_count - page : 0;
+      break;
+    case KEY_RESIZE:
+      getmaxyx(stdscr, view_rows, view_cols);
+      page = view_rows > 1 ? view_rows - 1 : 1;
+      break;
+    case '/':
+      curs_set(1);
+      if (readScrollbackPattern(pattern)) {
+        if (has_matcher)
+          matcherFree(&m);
+        has_matcher = matcherCompile(&m, pattern, 0) == 0;
+        if (!has_matcher)
+          strcpy(status, "[bledny wzorzec]");
       }
-      closedir(dir);
+      curs_set(0);
+      if (!has_matcher)
+        break;
+      // fall through
+    case 'n': {
+      size_t line_start, line_end;
+      if (!has_matcher || top + 1 >= lines_count)
+        break;
+      if (matcherFindLine(&m, output_spool.map, spoolLineOffset(top + 1), output_spool.size, &line_start, &line_end))
+        top = spoolLineAt(line_start);
+      else
+        strcpy(status, "[brak dalszych trafien]");
+      break;
+    }
+    case 'N': {
+      size_t line_start;
+      if (!has_matcher)
+        break;
+      mvwprintw(w, view_rows - 1, 0, " [szukanie wstecz, ESC przerywa]");
+      wclrtoeol(w);
+      wrefresh(w);
+
+      int found = scrollbackFindBackward(&m, spoolLineOffset(top), &line_start);
+      if (found == TRUE)
+        top = spoolLineAt(line_start);
+      else if (found == -1)
+        strcpy(status, "[szukanie przerwane]");
+      else
+        strcpy(status, "[brak wczesniejszych trafien]");
+      break;
+    }
     }
-  } else if (access(source, F_OK == 0)) {
-    cpFile(source, dest, override);
-  } else if (is_first_call) {
-    wprintw(p, "Nie ma takiego pliku\n");
   }
+
+  if (has_matcher)
+    matcherFree(&m);
+
+  werase(w);
+  touchwin(p);
+  curs_set(1);
 }
 
 // REGEX
 // https://man7.org/linux/man-pages/man3/regex.3.html
-void grep(char *file, char *pattern, int case_insensitive) {
-  if (access(file, F_OK) != 0) {
-    wprintw(p, "Brak pliku %s\n", file);
-    return;
+
+int isLiteralPattern(char *pattern) {
+  for (char *c = pattern; *c != '\0'; c++)
+    if (strchr(".[]()*+?{}|^$\\", *c) != NULL)
+      return FALSE;
+  return TRUE;
+}
+
+int matcherCompile(struct matcher *m, char *pattern, int case_insensitive) {
+  // wzorce bez znakow specjalnych szukamy przez memmem() po calym buforze,
+  // zamiast wywolywac regexec() dla kazdej linii
+  m->is_literal = !case_insensitive && strlen(pattern) > 0 && isLiteralPattern(pattern);
+  m->literal = pattern;
+  m->literal_length = strlen(pattern);
+
+  int flags = REG_EXTENDED | REG_NEWLINE | (case_insensitive ? REG_ICASE : 0);
+  return regcomp(&m->regex, pattern, flags);
+}
+
+void matcherFree(struct matcher *m) {
+  regfree(&m->regex);
+}
+
+int matcherFindLine(struct matcher *m, const char *data, size_t start, size_t end, size_t *line_start, size_t *line_end) {
+  if (m->is_literal) {
+    const char *found = memmem(data + start, end - start, m->literal, m->literal_length);
+    if (found == NULL)
+      return FALSE;
+
+    const char *line = memrchr(data + start, '\n', found - (data + start));
+    const char *line_stop = memchr(found, '\n', data + end - found);
+    *line_start = line == NULL ? start : (size_t)(line - data) + 1;
+    *line_end = line_stop == NULL ? end : (size_t)(line_stop - data);
+    return TRUE;
   }
 
-  FILE *fd = fopen(file, "r");
-  char source[2048];
-  while (fgets(source, 2048, fd)) {
-    int maximum_matches = 10, maximum_groups = 10;
+  size_t position = start;
+  while (position < end) {
+    const char *line_stop = memchr(data + position, '\n', end - position);
+    size_t stop = line_stop == NULL ? end : (size_t)(line_stop - data);
+
+    // REG_STARTEND pozwala przeszukac linie bez kopiowania jej do osobnego bufora
+    regmatch_t range;
+    range.rm_so = position;
+    range.rm_eo = stop;
+    if (regexec(&m->regex, data, 1, &range, REG_STARTEND) == 0) {
+      *line_start = position;
+      *line_end = stop;
+      return TRUE;
+    }
 
-    regex_t compiled_regex;
-    regmatch_t groups[10];
+    position = stop + 1;
+  }
 
-    int flags = case_insensitive ? REG_ICASE : REG_EXTENDED;
-    if (regcomp(&compiled_regex, pattern, flags)) {
-      wprintw(p, "Blad skladni polecenia grep\n");
-      return;
-    };
+  return FALSE;
+}
 
-    int match = 0;
-    char *cur = source;
-    int previous_end = 0;
-    for (match = 0; match < maximum_matches; match++) {
-      if (regexec(&compiled_regex, cur, maximum_groups, groups, 0))
-        break;
+size_t countNewlines(const char *data, size_t length) {
+  size_t count = 0, i = 0;
 
-      int group = 0, bytes_offset = 0;
-      for (group = 0; group < maximum_groups; group++) {
-        if (groups[group].rm_so == -1)
-          break;
+#ifdef __SSE2__
+  // porownuj po 16 bajtow naraz, maska bitowa mowi ile z nich to '\n'
+  const __m128i newline = _mm_set1_epi8('\n');
+  for (; i + 16 <= length; i += 16) {
+    __m128i block = _mm_loadu_si128((const __m128i *)(data + i));
+    count += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(block, newline)));
+  }
+#endif
 
-        if (group == 0)
-          bytes_offset = groups[group].rm_eo;
-        
-        for (int i = previous_end; i < groups[group].rm_so + previous_end; i++)
-          waddch(p, source[i]);
+  for (; i < length; i++)
+    if (data[i] == '\n')
+      count++;
 
-        if (has_colors() == TRUE) wattron(p, COLOR_PAIR(PAIR_YELLOW));
-        wattron(p, A_BOLD);
-        for (int i = groups[group].rm_so + previous_end; i < groups[group].rm_eo + previous_end; i++) {
-          waddch(p, source[i]);
-        }
-        if (has_colors() == TRUE) wattroff(p, COLOR_PAIR(PAIR_YELLOW));
-        wattroff(p, A_BOLD);
-        previous_end = groups[group].rm_eo + previous_end;
+  return count;
+}
+
+void grepAddMatch(struct grep_chunk *chunk, size_t start, size_t end, size_t line) {
+  if (chunk->matches_count == chunk->matches_capacity) {
+    chunk->matches_capacity = chunk->matches_capacity == 0 ? 64 : chunk->matches_capacity * 2;
+    chunk->matches = realloc(chunk->matches, chunk->matches_capacity * sizeof(struct grep_match));
+  }
+
+  chunk->matches[chunk->matches_count].start = start;
+  chunk->matches[chunk->matches_count].end = end;
+  chunk->matches[chunk->matches_count].line = line;
+  chunk->matches_count++;
+}
+
+void grepSearchChunk(struct grep_job *job, struct matcher *m, long index) {
+  struct grep_chunk *chunk = &job->chunks[index];
+  size_t position = chunk->start, line_start, line_end, line = 0;
+
+  while (position < chunk->end && index <= atomic_load_explicit(&job->cutoff, memory_order_relaxed)) {
+    if (!matcherFindLine(m, job->data, position, chunk->end, &line_start, &line_end))
+      break;
+
+    if (job->options->line_numbers)
+      line += countNewlines(job->data + position, line_start - position);
+
+    grepAddMatch(chunk, line_start, line_end, line);
+    line++;
+
+    // -q i -l potrzebuja tylko jednego trafienia, -m najwyzej max_count z chunka
+    if (job->options->quiet || job->options->files_only)
+      break;
+    if (job->options->max_count != -1 && (long)chunk->matches_count >= job->options->max_count)
+      break;
+
+    position = line_end + 1;
+  }
+
+  if (job->options->line_numbers)
+    chunk->newlines = countNewlines(job->data + chunk->start, chunk->end - chunk->start);
+
+  pthread_mutex_lock(&job->mutex);
+  chunk->done = TRUE;
+
+  if (job->options->quiet || job->options->files_only) {
+    if (chunk->matches_count > 0)
+      atomic_store(&job->cutoff, -1);
+  } else if (job->options->max_count != -1) {
+    // gotowy prefiks chunkow zawiera juz max_count linii => reszta jest zbedna
+    long total = 0;
+    for (long i = 0; i < job->chunks_count && job->chunks[i].done; i++) {
+      total += job->chunks[i].matches_count;
+      if (total >= job->options->max_count) {
+        if (i < atomic_load(&job->cutoff))
+          atomic_store(&job->cutoff, i);
+        break;
       }
-      cur += bytes_offset;
     }
+  }
+
+  pthread_mutex_unlock(&job->mutex);
+}
 
-    if (previous_end != 0)
-      for (int i = previous_end; i < strlen(source); i++)
+void *grepWorker(void *argument) {
+  struct grep_job *job = argument;
+  struct matcher m;
+
+  // glibc blokuje regex_t na czas regexec(), wiec kazdy watek kompiluje wlasny
+  if (matcherCompile(&m, job->pattern, job->options->case_insensitive))
+    return NULL;
+
+  long index;
+  while ((index = atomic_fetch_add(&job->next_chunk, 1)) < job->chunks_count) {
+    if (index > atomic_load(&job->cutoff))
+      break;
+    grepSearchChunk(job, &m, index);
+  }
+
+  matcherFree(&m);
+  return NULL;
+}
+
+void grepPrintLine(char *source, regex_t *compiled_regex) {
+  int maximum_matches = 10, maximum_groups = 10;
+  regmatch_t groups[10];
+
+  int match = 0;
+  char *cur = source;
+  int previous_end = 0;
+  for (match = 0; match < maximum_matches; match++) {
+    if (regexec(compiled_regex, cur, maximum_groups, groups, match > 0 ? REG_NOTBOL : 0))
+      break;
+
+    int group = 0, bytes_offset = 0;
+    for (group = 0; group < maximum_groups; group++) {
+      if (groups[group].rm_so == -1)
+        break;
+
+      if (group == 0)
+        bytes_offset = groups[group].rm_eo;
+
+      for (int i = previous_end; i < groups[group].rm_so + previous_end; i++)
+        waddch(p, source[i]);
+
+      if (has_colors() == TRUE) wattron(p, COLOR_PAIR(PAIR_YELLOW));
+      wattron(p, A_BOLD);
+      for (int i = groups[group].rm_so + previous_end; i < groups[group].rm_eo + previous_end; i++) {
         waddch(p, source[i]);
+      }
+      if (has_colors() == TRUE) wattroff(p, COLOR_PAIR(PAIR_YELLOW));
+      wattroff(p, A_BOLD);
+      previous_end = groups[group].rm_eo + previous_end;
+    }
 
-    regfree(&compiled_regex);
+    if (bytes_offset == 0)
+      break;
+    cur += bytes_offset;
   }
+
+  for (int i = previous_end; i < strlen(source); i++)
+    waddch(p, source[i]);
   waddch(p, '\n');
-  fclose(fd);
+}
+
+void grepShowLine(const char *number, int number_length, const char *text, size_t length, regex_t *regex) {
+  char *source = malloc(length + 1);
+  memcpy(source, text, length);
+  source[length] = '\0';
+
+  if (number_length > 0) {
+    if (has_colors() == TRUE) wattron(p, COLOR_PAIR(PAIR_GREEN));
+    wprintw(p, "%.*s", number_length, number);
+    if (has_colors() == TRUE) wattroff(p, COLOR_PAIR(PAIR_GREEN));
+  }
+
+  grepPrintLine(source, regex);
+  free(source);
+}
+
+// pliki bez znanego rozmiaru (procfs, sysfs, FIFO, urzadzenia) nie daja sie
+// zmapowac, wiec czytamy je po kolei przez read(); pelne linie ida przez ten
+// sam matcherFindLine(), trafienia do spoola, na ekran jego koncowka
+void grepStream(int fd, char *file, struct matcher *m, struct grep_options *options) {
+  size_t capacity = GREP_STREAM_BUFFER, length = 0, line = 1;
+  char *buffer = malloc(capacity);
+  long matches = 0;
+  int done = FALSE, failed = FALSE;
+
+  if (!options->quiet && !options->files_only)
+    spoolBegin();
+
+  while (!done) {
+    if (length == capacity) {
+      capacity *= 2;
+      buffer = realloc(buffer, capacity);
+    }
+
+    ssize_t num = read(fd, buffer + length, capacity - length);
+    if (num == -1 && errno == EINTR)
+      continue;
+    if (num <= 0) {
+      // przy EOF ostatnia linia moze nie miec '\n'
+      failed = num == -1;
+      done = TRUE;
+    } else {
+      length += num;
+    }
+
+    size_t end = length;
+    if (!done) {
+      const char *newline = memrchr(buffer, '\n', length);
+      if (newline == NULL)
+        continue;
+      end = newline - buffer + 1;
+    }
+
+    size_t position = 0, line_start, line_end;
+    while (position < end && matcherFindLine(m, buffer, position, end, &line_start, &line_end)) {
+      if (options->line_numbers)
+        line += countNewlines(buffer + position, line_start - position);
+      matches++;
+
+      if (options->quiet || options->files_only) {
+        done = TRUE;
+        break;
+      }
+
+      if (options->line_numbers) {
+        char number[32];
+        spoolWrite(number, snprintf(number, sizeof(number), "%zu:", line));
+      }
+      spoolWrite(buffer + line_start, line_end - line_start);
+      spoolWrite("\n", 1);
+      line++;
+
+      position = line_end + 1;
+      if (options->max_count != -1 && matches >= options->max_count) {
+        done = TRUE;
+        break;
+      }
+    }
+
+    if (options->line_numbers && position < end)
+      line += countNewlines(buffer + position, end - position);
+    memmove(buffer, buffer + end, length - end);
+    length -= end;
+  }
+  free(buffer);
+
+  if (failed)
+    wprintw(p, "Blad odczytu pliku %s\n", file);
+
+  if (options->files_only) {
+    if (matches > 0)
+      wprintw(p, "%s\n", file);
+    return;
+  }
+  if (options->quiet || spoolMap() == NULL)
+    return;
+
+  // jak spoolEnd(), ale z podswietleniem; numer linii to prefiks do pierwszego ':'
+  size_t lines_count = spoolLinesCount(), first = 0;
+  if (lines_count > spoolTailLines()) {
+    first = lines_count - spoolTailLines();
+    printSpoolNote(first);
+  }
+
+  size_t offset = spoolLineOffset(first);
+  while (offset < output_spool.size) {
+    size_t stop = spoolLineEnd(offset);
+    const char *text = output_spool.map + offset;
+    int number_length = 0;
+    if (options->line_numbers)
+      number_length = (const char *)memchr(text, ':', stop - offset) - text + 1;
+    grepShowLine(text, number_length, text + number_length, stop - offset - number_length, &m->regex);
+    offset = stop + 1;
+  }
+}
+
+void grep(char *file, char *pattern, struct grep_options *options) {
+  if (access(file, F_OK) != 0) {
+    wprintw(p, "Brak pliku %s\n", file);
+    return;
+  }
+
+  struct grep_job job;
+  job.pattern = pattern;
+  job.options = options;
+
+  struct matcher m;
+  if (matcherCompile(&m, pattern, options->case_insensitive)) {
+    wprintw(p, "Blad skladni polecenia grep\n");
+    return;
+  }
+
+  int fd = open(file, O_RDONLY);
+  struct stat st;
+  if (fd == -1 || fstat(fd, &st) == -1) {
+    wprintw(p, "Nie mozna otworzyc pliku %s\n", file);
+    if (fd != -1) close(fd);
+    matcherFree(&m);
+    return;
+  }
+
+  if (!S_ISREG(st.st_mode) || st.st_size == 0) {
+    grepStream(fd, file, &m, options);
+    close(fd);
+    matcherFree(&m);
+    return;
+  }
+
+  job.size = st.st_size;
+  job.data = mmap(NULL, job.size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (job.data == MAP_FAILED) {
+    wprintw(p, "Blad funkcji mmap() dla pliku %s\n", file);
+    matcherFree(&m);
+    return;
+  }
+  madvise((void *)job.data, job.size, MADV_SEQUENTIAL);
+
+  // kilka chunkow na watek, zeby szybsze watki mogly przejac prace wolniejszych
+  int jobs = options->jobs < 1 ? 1 : options->jobs;
+  size_t chunk_size = job.size / ((size_t)jobs * GREP_CHUNKS_PER_JOB) + 1;
+  if (chunk_size < GREP_MIN_CHUNK) chunk_size = GREP_MIN_CHUNK;
+  if (chunk_size > GREP_MAX_CHUNK) chunk_size = GREP_MAX_CHUNK;
+
+  job.chunks_count = (job.size + chunk_size - 1) / chunk_size;
+  job.chunks = calloc(job.chunks_count, sizeof(struct grep_chunk));
+
+  // granice chunkow przesuwamy za najblizszy '\n', zeby zadna linia nie byla podzielona
+  size_t position = 0;
+  long count = 0;
+  while (position < job.size) {
+    size_t end = position + chunk_size;
+    if (end >= job.size) {
+      end = job.size;
+    } else {
+      const char *newline = memchr(job.data + end, '\n', job.size - end);
+      end = newline == NULL ? job.size : (size_t)(newline - job.data) + 1;
+    }
+
+    job.chunks[count].start = position;
+    job.chunks[count].end = end;
+    count++;
+    position = end;
+  }
+  job.chunks_count = count;
+
+  atomic_init(&job.next_chunk, 0);
+  atomic_init(&job.cutoff, job.chunks_count - 1);
+  pthread_mutex_init(&job.mutex, NULL);
+
+  if (jobs > job.chunks_count)
+    jobs = job.chunks_count;
+
+  if (jobs <= 1) {
+    grepWorker(&job);
+  } else {
+    pthread_t *threads = malloc(jobs * sizeof(pthread_t));
+    for (int i = 0; i < jobs; i++)
+      pthread_create(&threads[i], NULL, grepWorker, &job);
+    for (int i = 0; i < jobs; i++)
+      pthread_join(threads[i], NULL);
+    free(threads);
+  }
+
+  pthread_mutex_destroy(&job.mutex);
+
+  if (options->quiet || options->files_only) {
+    int found = FALSE;
+    for (long i = 0; i < job.chunks_count; i++)
+      if (job.chunks[i].matches_count > 0)
+        found = TRUE;
+
+    if (found && options->files_only)
+      wprintw(p, "%s\n", file);
+  } else {
+    // sklejanie wynikow w kolejnosci pliku, numery linii to suma '\n' z poprzednich chunkow
+    long printed = 0, total = 0, cutoff = atomic_load(&job.cutoff);
+    size_t line_offset = 1;
+    for (long i = 0; i <= cutoff && i < job.chunks_count; i++)
+      total += job.chunks[i].matches_count;
+    if (options->max_count != -1 && total > options->max_count)
+      total = options->max_count;
+
+    // wszystko idzie do spoola, na ekran tylko ostatnie linie z podswietleniem
+    long first_shown = total > (long)spoolTailLines() ? total - (long)spoolTailLines() : 0;
+    spoolBegin();
+    if (first_shown > 0)
+      printSpoolNote(first_shown);
+
+    for (long i = 0; i <= cutoff && i < job.chunks_count; i++) {
+      struct grep_chunk *chunk = &job.chunks[i];
+      for (size_t j = 0; j < chunk->matches_count; j++) {
+        if (options->max_count != -1 && printed >= options->max_count)
+          break;
+
+        size_t length = chunk->matches[j].end - chunk->matches[j].start;
+        char number[32];
+        int number_length = 0;
+        if (options->line_numbers) {
+          number_length = snprintf(number, sizeof(number), "%zu:", line_offset + chunk->matches[j].line);
+          spoolWrite(number, number_length);
+        }
+        spoolWrite(job.data + chunk->matches[j].start, length);
+        spoolWrite("\n", 1);
+
+        if (printed++ < first_shown)
+          continue;
+
+        grepShowLine(number, number_length, job.data + chunk->matches[j].start, length, &m.regex);
+      }
+      line_offset += chunk->newlines;
+    }
+  }
+
+  for (long i = 0; i < job.chunks_count; i++)
+    free(job.chunks[i].matches);
+  free(job.chunks);
+  munmap((void *)job.data, job.size);
+  matcherFree(&m);
 }
 
 void help() {
@@ -805,10 +3635,30 @@ void help() {
     - cp [-R] [-O] skad dokad\n\
       -R = recursive (kopiuj tez podfoldery)\n\
       -O = override (nadpisuj pliki o ile istnieja)\n\
-    - grep [-i] wzorzec plik\n\
+    - grep [-i] [-n] [-l] [-q] [-m N] [-j N] wzorzec plik\n\
       -i = case insensitive (nie rozrozniaj wielkich liter)\n\
+      -n = wypisuj numery linii\n\
+      -l = wypisz tylko nazwe pliku, jesli sa trafienia\n\
+      -q = nic nie wypisuj\n\
+      -m = zakoncz po N pasujacych liniach\n\
+      -j = przeszukuj plik w N watkach naraz\n\
+    - find [katalog] [-name wzorzec] [-type f|d|l] [-size [+-]N[ckMG]] [-mtime [+-]N] [-j N]\n\
+      przeszukuje drzewo katalogow w N watkach\n\
     - cd sciezka\n\
+    - scrollback (lub PgUp) - przegladanie pelnego wyjscia ostatniej komendy\n\
+      / = szukaj, n/N = nastepne/poprzednie trafienie, q = wyjscie\n\
+    - parallel [-j N] [-k] komenda [{}] ::: argumenty\n\
+    - parallel [-j N] [-k] komenda [{}] :::: plik\n\
+      uruchamia komende dla kazdego argumentu, najwyzej N naraz\n\
+      {} = miejsce argumentu (domyslnie na koncu)\n\
+      -k = wypisuj wyniki w kolejnosci argumentow, a nie zakonczenia\n\
+    - export NAZWA=wartosc\n\
+      PROMPT = szablon znaku zachety, np. '%%M[%%G%%u%%N:%%Y%%w%%M]%%C%%v%%B $ %%N'\n\
+      %%u login, %%h host, %%w katalog, %%W nazwa katalogu, %%v galaz gita\n\
+      %%M %%G %%Y %%B %%C = kolory, %%N = bez koloru\n\
     - help\n\
+    - CTRL+F = podpowiedzi fuzzy (komendy, pliki, historia), strzalki wybieraja,\n\
+      TAB wstawia, ESC zamyka\n\
     - programy znajdujace sie w katalogach w PATH\n\
   \n";
 
@@ -830,8 +3680,11 @@ void runExit() {
       free(history[i]);
   }
   free(history);
+  spoolClose();
 
   clear();
   endwin();
+  printf("\033[?2004l");
+  fflush(stdout);
   exit(EXIT_SUCCESS);
 }
\ No newline at end of file